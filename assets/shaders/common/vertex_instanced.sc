@@ -0,0 +1,19 @@
+$input a_position, a_normal, a_texcoord0, a_color0, i_data0, i_data1, i_data2, i_data3, i_data4
+$output v_color0, v_normal, v_texcoord0
+
+/*
+ * Copyright 2011-2024 Branimir Karadzic. All rights reserved.
+ * License: https://github.com/bkaradzic/bgfx/blob/master/LICENSE
+ */
+
+#include <bgfx_shader.sh>
+
+void main()
+{
+    mat4 model = mtxFromCols(i_data0, i_data1, i_data2, i_data3);
+    vec4 position = mul(model, vec4(a_position, 1.0));
+    gl_Position = mul(u_viewProj, position);
+    v_texcoord0 = a_texcoord0;
+    v_normal = a_normal;
+    v_color0 = a_color0 * i_data4;
+}
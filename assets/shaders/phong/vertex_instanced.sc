@@ -0,0 +1,32 @@
+$input a_position, a_normal, a_texcoord0, a_color0, i_data0, i_data1, i_data2, i_data3
+$output v_color0, v_normal, v_texcoord0, v_pos
+
+/*
+ * Copyright 2011-2024 Branimir Karadzic. All rights reserved.
+ * License: https://github.com/bkaradzic/bgfx/blob/master/LICENSE
+ */
+
+#include <bgfx_shader.sh>
+
+void main()
+{
+    mat4 model = mtxFromCols(i_data0, i_data1, i_data2, i_data3);
+    vec4 position = mul(model, vec4(a_position, 1.0));
+    gl_Position = mul(u_viewProj, position);
+    v_pos = position.xyz;
+    v_texcoord0 = a_texcoord0;
+
+    // The cofactor matrix is the inverse transpose scaled by the determinant. This gives the
+    // proper normal for models with non-uniform scale without sending a normal matrix per
+    // instance. The sign of the determinant keeps the normal facing out for mirrored models.
+    vec3 c0 = i_data0.xyz;
+    vec3 c1 = i_data1.xyz;
+    vec3 c2 = i_data2.xyz;
+    vec3 n0 = cross(c1, c2);
+    vec3 n1 = cross(c2, c0);
+    vec3 n2 = cross(c0, c1);
+    float det_sign = sign(dot(c0, n0));
+    v_normal = (n0 * a_normal.x + n1 * a_normal.y + n2 * a_normal.z) * det_sign;
+
+    v_color0 = a_color0;
+}
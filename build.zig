@@ -143,6 +143,24 @@ pub fn build(b: *std.Build) !void {
         .{ .module_name = "render", .link_params = &.{} },
         .{ .module_name = "world", .link_params = &.{} },
     });
+
+    try builder.addBenchmarks(b, &.{
+        .{
+            .name = "world",
+            .root = "src/benchmarks/world.zig",
+            .imports = &.{"world"},
+            .link_params = &.{},
+        },
+        .{
+            .name = "obj",
+            .root = "src/benchmarks/obj.zig",
+            .imports = &.{ "core", "io", "render" },
+            .link_params = &.{
+                .{ .dependency = "lunasvg", .artifact = "bindings" },
+                .{ .dependency = "zbgfx", .artifact = "bgfx" },
+            },
+        },
+    });
 }
 
 const Builder = struct {
@@ -300,4 +318,46 @@ const Builder = struct {
             step.dependOn(&run.step);
         }
     }
+
+    pub const BenchmarkParam = struct {
+        name: []const u8,
+        root: []const u8,
+        imports: []const []const u8,
+        link_params: []const TestParam.LinkParam,
+    };
+
+    /// Benchmarks are standalone executables. Use '-Doptimize=ReleaseFast' for meaningful results.
+    pub fn addBenchmarks(
+        self: Self,
+        b: *std.Build,
+        benchmarks: []const BenchmarkParam,
+    ) !void {
+        const step = b.step("bench", "Run benchmarks");
+
+        for (benchmarks) |param| {
+            const module = b.createModule(.{
+                .root_source_file = b.path(param.root),
+                .target = self.target,
+                .optimize = self.optimize,
+            });
+
+            for (param.imports) |import| {
+                module.addImport(import, try self.getModule(import));
+            }
+
+            const benchmark = b.addExecutable(.{
+                .name = b.fmt("bench_{s}", .{param.name}),
+                .root_module = module,
+            });
+
+            for (param.link_params) |link| {
+                const artifact = try self.dependencyArtifact(link.dependency, link.artifact);
+                benchmark.linkLibrary(artifact);
+            }
+
+            const run = b.addRunArtifact(benchmark);
+
+            step.dependOn(&run.step);
+        }
+    }
 };
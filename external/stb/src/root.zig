@@ -27,6 +27,8 @@ const Allocations = struct {
 
     allocs: std.ArrayList(Allocation),
     allocator: std.mem.Allocator,
+    /// Images may be decoded on worker threads.
+    mutex: std.Thread.Mutex = .{},
 
     pub fn init(allocator: std.mem.Allocator) !Self {
         return Self{
@@ -40,6 +42,9 @@ const Allocations = struct {
     }
 
     pub fn malloc(self: *Self, size: usize) []u8 {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
         const result = self.allocator.alloc(u8, size) catch |err| {
             std.debug.panic("Failed to allocate memory: {}", .{err});
         };
@@ -48,6 +53,9 @@ const Allocations = struct {
     }
 
     pub fn realloc(self: *Self, alloc: ?*anyopaque, size: usize) []u8 {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
         const old_size = if (alloc) |p| self.remove(p) else 0;
         const ptr: [*]u8 = if (alloc) |p| @ptrCast(p) else undefined;
         const result = self.allocator.realloc(ptr[0..old_size], size) catch |err| {
@@ -58,6 +66,9 @@ const Allocations = struct {
     }
 
     pub fn free(self: *Self, alloc: *anyopaque) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
         const size = self.remove(alloc);
         const ptr: [*]u8 = @ptrCast(alloc);
         self.allocator.free(ptr[0..size]);
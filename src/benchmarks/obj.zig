@@ -0,0 +1,239 @@
+const core = @import("core");
+const io = @import("io");
+const render = @import("render");
+const std = @import("std");
+
+const mesh_cache = render.mesh_cache;
+const LineReader = io.LineReader;
+const Meshes = render.Meshes;
+const Model = io.obj.Model;
+const Vec = core.math.Vec;
+
+/// The number of quads along each side of the generated grid.
+const grid_size: usize = 600;
+const iteration_count: usize = 5;
+
+const directory = ".zig-cache/bench";
+const model_path = directory ++ "/grid.obj";
+const cache_path = model_path ++ mesh_cache.extension;
+
+/// Writes a flat grid of quads with normals and texture coordinates.
+fn generate() !void {
+    try std.fs.cwd().makePath(directory);
+
+    const file = try std.fs.cwd().createFile(model_path, .{});
+    defer file.close();
+
+    var buffer: [64 * 1024]u8 = undefined;
+    var file_writer = file.writer(&buffer);
+    const writer = &file_writer.interface;
+
+    const side = grid_size + 1;
+    for (0..side) |y| {
+        for (0..side) |x| {
+            try writer.print("v {d:.6} 0.000000 {d:.6}\n", .{ toFloat(x), toFloat(y) });
+        }
+    }
+
+    for (0..side) |y| {
+        for (0..side) |x| {
+            try writer.print("vt {d:.6} {d:.6}\n", .{
+                toFloat(x) / toFloat(grid_size),
+                toFloat(y) / toFloat(grid_size),
+            });
+        }
+    }
+
+    try writer.writeAll("vn 0.000000 1.000000 0.000000\n");
+
+    for (0..grid_size) |y| {
+        for (0..grid_size) |x| {
+            const a = y * side + x + 1;
+            const b = a + 1;
+            const c = a + side + 1;
+            const d = a + side;
+            try writer.print("f {0}/{0}/1 {1}/{1}/1 {2}/{2}/1 {3}/{3}/1\n", .{ a, b, c, d });
+        }
+    }
+
+    try writer.flush();
+}
+
+/// The loader this replaced. Lines are read through a LineReader on the calling thread and each
+/// face owns its own list of elements.
+const Baseline = struct {
+    const Face = std.ArrayList(Model.Face.Element);
+
+    vertices: std.ArrayList(Vec) = .empty,
+    tex_coords: std.ArrayList(Vec) = .empty,
+    normals: std.ArrayList(Vec) = .empty,
+    faces: std.ArrayList(Face) = .empty,
+
+    fn load(allocator: std.mem.Allocator, path: []const u8) !Baseline {
+        var reader: LineReader = try .initFile(allocator, path);
+        defer reader.deinit(allocator);
+
+        var result: Baseline = .{};
+        errdefer result.deinit(allocator);
+
+        while (try reader.readLine()) |line| {
+            try result.processLine(allocator, line);
+        }
+
+        return result;
+    }
+
+    fn deinit(self: *Baseline, allocator: std.mem.Allocator) void {
+        self.vertices.deinit(allocator);
+        self.tex_coords.deinit(allocator);
+        self.normals.deinit(allocator);
+        for (self.faces.items) |*face| {
+            face.deinit(allocator);
+        }
+        self.faces.deinit(allocator);
+    }
+
+    fn processLine(self: *Baseline, allocator: std.mem.Allocator, line: []const u8) !void {
+        if (line.len < 2) {
+            return;
+        }
+
+        var it = std.mem.tokenizeAny(u8, line, " ");
+        const key = it.next() orelse return;
+        if (std.mem.eql(u8, key, "v")) {
+            try self.vertices.append(allocator, parseVec(&it));
+        } else if (std.mem.eql(u8, key, "vt")) {
+            try self.tex_coords.append(allocator, parseVec(&it));
+        } else if (std.mem.eql(u8, key, "vn")) {
+            try self.normals.append(allocator, parseVec(&it));
+        } else if (std.mem.eql(u8, key, "f")) {
+            var face: Face = try .initCapacity(allocator, 3);
+            errdefer face.deinit(allocator);
+
+            while (it.next()) |token| {
+                var indices = std.mem.splitScalar(u8, token, '/');
+                try face.append(allocator, .{
+                    .vertex = parseIndex(indices.next()),
+                    .texture = parseIndex(indices.next()),
+                    .normal = parseIndex(indices.next()),
+                });
+            }
+
+            try self.faces.append(allocator, face);
+        }
+    }
+
+    fn parseVec(it: *std.mem.TokenIterator(u8, .any)) Vec {
+        const x = std.fmt.parseFloat(f32, it.next() orelse "") catch 0.0;
+        const y = std.fmt.parseFloat(f32, it.next() orelse "") catch 0.0;
+        const z = std.fmt.parseFloat(f32, it.next() orelse "") catch 0.0;
+        return .init(x, y, z, 1.0);
+    }
+
+    fn parseIndex(token: ?[]const u8) u32 {
+        return std.fmt.parseInt(u32, token orelse "", 10) catch 0;
+    }
+};
+
+fn parseBaseline(allocator: std.mem.Allocator) !u64 {
+    const path = try std.fs.cwd().realpathAlloc(allocator, model_path);
+    defer allocator.free(path);
+
+    var timer = try std.time.Timer.start();
+    for (0..iteration_count) |_| {
+        var model: Baseline = try .load(allocator, path);
+        model.deinit(allocator);
+    }
+
+    return timer.read() / iteration_count;
+}
+
+fn parse(allocator: std.mem.Allocator, threads: usize) !u64 {
+    var timer = try std.time.Timer.start();
+    for (0..iteration_count) |_| {
+        var model = try Model.loadFileWith(allocator, model_path, .{
+            .threads = threads,
+        });
+        model.deinit(allocator);
+    }
+
+    return timer.read() / iteration_count;
+}
+
+fn convert(allocator: std.mem.Allocator) !u64 {
+    var model = try Model.loadFile(allocator, model_path);
+    defer model.deinit(allocator);
+
+    var timer = try std.time.Timer.start();
+    for (0..iteration_count) |_| {
+        var buffer = try Meshes.convert(allocator, model);
+        buffer.deinit(allocator);
+    }
+
+    return timer.read() / iteration_count;
+}
+
+fn loadCache(allocator: std.mem.Allocator) !u64 {
+    const dir = std.fs.cwd();
+    const source: mesh_cache.Source = try .fromFile(dir, model_path);
+
+    {
+        var model = try Model.loadFile(allocator, model_path);
+        defer model.deinit(allocator);
+
+        var buffer = try Meshes.convert(allocator, model);
+        defer buffer.deinit(allocator);
+
+        try mesh_cache.write(dir, cache_path, source, buffer, model.material_paths.items);
+    }
+
+    var timer = try std.time.Timer.start();
+    for (0..iteration_count) |_| {
+        var entry = try mesh_cache.read(allocator, dir, cache_path, source) orelse
+            return error.InvalidCache;
+        entry.deinit(allocator);
+    }
+
+    return timer.read() / iteration_count;
+}
+
+pub fn main() !void {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}).init;
+    defer _ = gpa.deinit();
+
+    const allocator = gpa.allocator();
+
+    try generate();
+    defer std.fs.cwd().deleteTree(directory) catch {};
+
+    const stat = try std.fs.cwd().statFile(model_path);
+    std.log.info("OBJ benchmarks with {} quads ({d:.1} MiB) over {} iterations.", .{
+        grid_size * grid_size,
+        @as(f64, @floatFromInt(stat.size)) / (1024.0 * 1024.0),
+        iteration_count,
+    });
+
+    const baseline = try parseBaseline(allocator);
+    std.log.info("Parse (line reader baseline): {d:.3} ms", .{toMilliseconds(baseline)});
+
+    const serial = try parse(allocator, 1);
+    std.log.info("Parse (1 thread): {d:.3} ms", .{toMilliseconds(serial)});
+
+    const cpu_count = std.Thread.getCpuCount() catch 1;
+    const parallel = try parse(allocator, cpu_count);
+    std.log.info("Parse ({} threads): {d:.3} ms", .{ cpu_count, toMilliseconds(parallel) });
+
+    const converted = try convert(allocator);
+    std.log.info("Convert: {d:.3} ms", .{toMilliseconds(converted)});
+
+    const cached = try loadCache(allocator);
+    std.log.info("Cache load: {d:.3} ms", .{toMilliseconds(cached)});
+}
+
+fn toFloat(value: usize) f32 {
+    return @floatFromInt(value);
+}
+
+fn toMilliseconds(ns: u64) f64 {
+    return @as(f64, @floatFromInt(ns)) / std.time.ns_per_ms;
+}
@@ -0,0 +1,161 @@
+const std = @import("std");
+const world = @import("world");
+
+const Query = world.Query;
+const SystemParam = world.SystemParam;
+const World = world.World;
+
+const entity_count: usize = 100_000;
+const frame_count: usize = 100;
+
+const Position = struct {
+    x: f32 = 0.0,
+    y: f32 = 0.0,
+    z: f32 = 0.0,
+};
+
+const Velocity = struct {
+    x: f32 = 1.0,
+    y: f32 = 1.0,
+    z: f32 = 1.0,
+};
+
+fn moveGetComponent(query: Query(&.{ Position, Velocity }), param: SystemParam) !void {
+    var entities = query.getEntities();
+    while (entities.next()) |entity| {
+        const position = param.getComponent(Position, entity.*) orelse continue;
+        const velocity = param.getComponent(Velocity, entity.*) orelse continue;
+        position.x += velocity.x;
+        position.y += velocity.y;
+        position.z += velocity.z;
+    }
+}
+
+fn moveIter(query: Query(&.{ Position, Velocity }), param: SystemParam) !void {
+    var it = query.iter(param.world);
+    while (it.next()) |item| {
+        const position = item.get(Position);
+        const velocity = item.get(Velocity);
+        position.x += velocity.x;
+        position.y += velocity.y;
+        position.z += velocity.z;
+    }
+}
+
+/// The component storage this replaced. Each component type maps entity ids to indices into its
+/// dense array through a hash map, and a second map finds the entity of an index on removal.
+fn Baseline(comptime T: type) type {
+    return struct {
+        const Self = @This();
+
+        components: std.ArrayListUnmanaged(T) = .empty,
+        entity_to_index: std.AutoHashMapUnmanaged(world.Entity.Id, usize) = .empty,
+        index_to_entity: std.AutoHashMapUnmanaged(usize, world.Entity.Id) = .empty,
+
+        fn deinit(self: *Self, allocator: std.mem.Allocator) void {
+            self.components.deinit(allocator);
+            self.entity_to_index.deinit(allocator);
+            self.index_to_entity.deinit(allocator);
+        }
+
+        fn insert(
+            self: *Self,
+            allocator: std.mem.Allocator,
+            entity: world.Entity,
+            component: T,
+        ) !void {
+            const index = self.components.items.len;
+            try self.entity_to_index.put(allocator, entity.id, index);
+            try self.index_to_entity.put(allocator, index, entity.id);
+            try self.components.append(allocator, component);
+        }
+
+        fn getMut(self: *Self, entity: world.Entity) ?*T {
+            const index = self.entity_to_index.get(entity.id) orelse return null;
+            return &self.components.items[index];
+        }
+    };
+}
+
+/// Same as 'moveGetComponent' over the baseline storage, without the world around it.
+fn runBaseline(allocator: std.mem.Allocator) !u64 {
+    var positions: Baseline(Position) = .{};
+    defer positions.deinit(allocator);
+    var velocities: Baseline(Velocity) = .{};
+    defer velocities.deinit(allocator);
+
+    const entities = try allocator.alloc(world.Entity, entity_count);
+    defer allocator.free(entities);
+
+    for (entities, 0..) |*entity, id| {
+        entity.* = .{ .id = @intCast(id) };
+        try positions.insert(allocator, entity.*, .{});
+        try velocities.insert(allocator, entity.*, .{});
+    }
+
+    var timer = try std.time.Timer.start();
+    for (0..frame_count) |_| {
+        for (entities) |entity| {
+            const position = positions.getMut(entity) orelse continue;
+            const velocity = velocities.getMut(entity) orelse continue;
+            position.x += velocity.x;
+            position.y += velocity.y;
+            position.z += velocity.z;
+        }
+    }
+
+    return timer.read() / frame_count;
+}
+
+/// Runs the given system over a world populated with 'entity_count' entities and returns the
+/// average frame time in nanoseconds.
+fn run(allocator: std.mem.Allocator, system: anytype) !u64 {
+    const _world: *World = try .init(allocator);
+    defer {
+        _world.deinit();
+        allocator.destroy(_world);
+    }
+
+    try _world.registerComponents(&.{ Position, Velocity });
+    _ = try _world.registerSystem(system, .update);
+
+    const entities = try allocator.alloc(world.Entity, entity_count);
+    defer allocator.free(entities);
+
+    try _world.createEntities(entities);
+    for (entities) |entity| {
+        try _world.insertComponents(entity, .{ Position{}, Velocity{} });
+    }
+
+    var timer = try std.time.Timer.start();
+    for (0..frame_count) |_| {
+        _world.runSystems(.update);
+    }
+
+    return timer.read() / frame_count;
+}
+
+pub fn main() !void {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}).init;
+    defer _ = gpa.deinit();
+
+    const allocator = gpa.allocator();
+
+    std.log.info("World benchmarks with {} entities over {} frames.", .{
+        entity_count,
+        frame_count,
+    });
+
+    const baseline = try runBaseline(allocator);
+    std.log.info("Baseline hash map storage: {d:.3} ms/frame", .{toMilliseconds(baseline)});
+
+    const get_component = try run(allocator, moveGetComponent);
+    std.log.info("getComponent: {d:.3} ms/frame", .{toMilliseconds(get_component)});
+
+    const iter = try run(allocator, moveIter);
+    std.log.info("Query.iter: {d:.3} ms/frame", .{toMilliseconds(iter)});
+}
+
+fn toMilliseconds(ns: u64) f64 {
+    return @as(f64, @floatFromInt(ns)) / std.time.ns_per_ms;
+}
@@ -48,25 +48,42 @@ pub fn Buffer2D(comptime T: type) type {
             self.height = height;
         }
 
+        /// Grows the buffer while keeping every existing value at the same coordinates. New
+        /// values are set to 'default'.
+        pub fn grow(self: *Self, width: usize, height: usize, default: T) !void {
+            if (width < self.width or height < self.height) {
+                return Error.IncorrectExpandSize;
+            }
+
+            var data = try std.ArrayList(T).initCapacity(self._allocator, width * height);
+            data.appendNTimesAssumeCapacity(default, width * height);
+
+            for (0..self.height) |y| {
+                const src = self.data.items[y * self.width ..][0..self.width];
+                @memcpy(data.items[y * width ..][0..self.width], src);
+            }
+
+            self.data.deinit(self._allocator);
+            self.data = data;
+            self.width = width;
+            self.height = height;
+        }
+
         pub fn put(self: *Self, x: usize, y: usize, value: T) Error!void {
             const index = try self.getIndex(x, y);
             self.data.items[index] = value;
         }
 
         pub fn putRegion(self: *Self, region: Rectus, value: []const T) Error!void {
-            var src: usize = 0;
-            var y = region.min.y;
-            while (y <= region.max.y) {
-                var x = region.min.x;
-                while (x <= region.max.x) {
-                    const index = try self.getIndex(x, y);
-                    self.data.items[index] = value[src];
-
-                    x += 1;
-                    src += 1;
-                }
+            if (region.max.x >= self.width or region.max.y >= self.height) {
+                return Error.OutOfBounds;
+            }
 
-                y += 1;
+            // Copy a row at a time.
+            const row_len = region.width() + 1;
+            for (0..region.height() + 1) |row| {
+                const dst = (region.min.y + row) * self.width + region.min.x;
+                @memcpy(self.data.items[dst..][0..row_len], value[row * row_len ..][0..row_len]);
             }
         }
 
@@ -208,6 +225,25 @@ test "resize" {
     try std.testing.expectEqual(Error.IncorrectExpandSize, buffer.expand(1, 1));
 }
 
+test "grow" {
+    const allocator = std.testing.allocator;
+    var buffer = try Buffer2D(u8).init(allocator, 2, 2, 0);
+    defer buffer.deinit();
+
+    try buffer.putRegion(.init(0, 0, 1, 1), &.{ 1, 2, 3, 4 });
+    try buffer.grow(3, 3, 9);
+
+    try std.testing.expectEqual(9, buffer.data.items.len);
+    try std.testing.expectEqual(1, try buffer.get(0, 0));
+    try std.testing.expectEqual(2, try buffer.get(1, 0));
+    try std.testing.expectEqual(9, try buffer.get(2, 0));
+    try std.testing.expectEqual(3, try buffer.get(0, 1));
+    try std.testing.expectEqual(4, try buffer.get(1, 1));
+    try std.testing.expectEqual(9, try buffer.get(2, 2));
+
+    try std.testing.expectEqual(Error.IncorrectExpandSize, buffer.grow(1, 3, 0));
+}
+
 test "getRegion" {
     const allocator = std.testing.allocator;
     var buffer = try Buffer2D(u8).init(allocator, 4, 4, 0);
@@ -0,0 +1,70 @@
+const math = @import("root.zig");
+const std = @import("std");
+const zmath = @import("zmath");
+
+const Mat = math.Mat;
+const Vec = math.Vec;
+
+/// The six planes of a view frustum, extracted from a view projection matrix. Each plane's normal
+/// points inside of the frustum.
+const Self = @This();
+
+planes: [6]zmath.Vec,
+
+/// Extracts the planes from a combined view and projection matrix. The projection is expected to
+/// map depth to [0, 1].
+pub fn init(view_projection: Mat) Self {
+    // Points are transformed as row vectors, so each clip space component is a column.
+    const columns = zmath.transpose(view_projection.data);
+
+    var result: Self = .{
+        .planes = .{
+            columns[3] + columns[0],
+            columns[3] - columns[0],
+            columns[3] + columns[1],
+            columns[3] - columns[1],
+            columns[2],
+            columns[3] - columns[2],
+        },
+    };
+
+    for (&result.planes) |*plane| {
+        const length = zmath.length3(plane.*);
+        plane.* = plane.* / length;
+    }
+
+    return result;
+}
+
+/// Returns false if the sphere lies completely outside of any plane.
+pub fn containsSphere(self: Self, center: Vec, radius: f32) bool {
+    var position = center.data;
+    position[3] = 1.0;
+
+    for (self.planes) |plane| {
+        const distance = zmath.dot4(plane, position)[0];
+        if (distance < -radius) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+test "contains sphere" {
+    const view: Mat = .initLookToLh(
+        .init3(0.0, 0.0, 0.0),
+        .init3(0.0, 0.0, 1.0),
+        .init3(0.0, 1.0, 0.0),
+    );
+    const projection: Mat = .initPerspectiveFovLh(60.0, 1.0);
+    const frustum: Self = .init(view.mul(projection));
+
+    try std.testing.expect(frustum.containsSphere(.init3(0.0, 0.0, 10.0), 1.0));
+    try std.testing.expect(!frustum.containsSphere(.init3(0.0, 0.0, -10.0), 1.0));
+    try std.testing.expect(!frustum.containsSphere(.init3(0.0, 0.0, 200.0), 1.0));
+    try std.testing.expect(!frustum.containsSphere(.init3(50.0, 0.0, 10.0), 1.0));
+
+    // Partially inside of the left plane.
+    try std.testing.expect(frustum.containsSphere(.init3(-6.5, 0.0, 10.0), 1.0));
+}
@@ -129,3 +129,20 @@ pub fn toArray(self: Self) [16]f32 {
 pub fn getTranslation(self: Self) Vec {
     return .init(self.data[3][0], self.data[3][1], self.data[3][2], self.data[3][3]);
 }
+
+/// Transforms the given point, treating it as having a w component of 1.
+pub fn transformPoint(self: Self, point: Vec) Vec {
+    var position = point.data;
+    position[3] = 1.0;
+    return .{
+        .data = zmath.mul(position, self.data),
+    };
+}
+
+/// Returns the largest scale applied to any of the axes.
+pub fn getMaxScale(self: Self) f32 {
+    const x = zmath.lengthSq3(self.data[0])[0];
+    const y = zmath.lengthSq3(self.data[1])[0];
+    const z = zmath.lengthSq3(self.data[2])[0];
+    return @sqrt(@max(x, @max(y, z)));
+}
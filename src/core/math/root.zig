@@ -5,6 +5,7 @@ const vec2 = @import("vec2.zig");
 
 pub const Color4b = color.Color4(u8);
 pub const Color4f = color.Color4(f32);
+pub const Frustum = @import("Frustum.zig");
 pub const HexColor = @import("HexColor.zig");
 
 pub const Mat = @import("Mat.zig");
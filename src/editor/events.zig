@@ -6,8 +6,10 @@ const std = @import("std");
 const world = @import("world");
 
 const Camera = editor.components.Camera;
+const Entity = world.Entity;
 const Material = io.obj.Material;
 const Mesh = render.ecs.components.Mesh;
+const MeshLoaded = render.ecs.events.MeshLoaded;
 const Model = io.obj.Model;
 const Phong = render.ecs.components.Phong;
 const Query = world.Query;
@@ -16,6 +18,7 @@ const SystemParam = world.SystemParam;
 const Texture = render.Texture;
 const Transform = world.components.core.Transform;
 const Vec = core.math.Vec;
+const World = world.World;
 
 pub const ResetCamera = struct {};
 
@@ -37,6 +40,7 @@ pub const LoadAssets = struct {
     paths: []const []const u8 = undefined,
 };
 
+/// Requests each model and creates its entity right away. See 'addModel'.
 pub fn onLoadAssets(assets: LoadAssets, param: SystemParam) !void {
     const render_resource = param.world.getResource(render.ecs.resources.Render) orelse unreachable;
     const renderer = render_resource.renderer;
@@ -48,27 +52,60 @@ pub fn onLoadAssets(assets: LoadAssets, param: SystemParam) !void {
             continue;
         }
 
-        var model = io.obj.Model.loadFile(param.allocator, path) catch |err| {
-            std.debug.panic("Failed to load model '{s}'. Error: {}", .{ path, err });
-        };
-        defer model.deinit(param.allocator);
-
-        const mesh = try renderer.loadMeshFromModel(model);
-        const material = if (model.materials.items.len > 0)
-            model.materials.items[0]
-        else
-            Material{};
-
-        _ = try param.world.createEntityWith(.{
-            Transform{},
-            Mesh{
-                .handle = mesh,
-            },
-            try toPhong(renderer, material),
-        });
+        _ = try addModel(param.world, renderer, path, .{});
     }
 }
 
+/// Requests the model at the given absolute path and creates an entity that draws it. The model
+/// is drawn once it has been loaded in the background, which is when its material is applied by
+/// 'onMeshLoaded'.
+pub fn addModel(
+    _world: *World,
+    renderer: *Renderer,
+    path: []const u8,
+    transform: Transform,
+) !Entity {
+    const handle = try renderer.assets.loadMesh(path);
+
+    // The model may have been loaded by an earlier request.
+    const materials = renderer.assets.getMaterials(handle) orelse &.{};
+    const material = if (materials.len > 0) materials[0] else Material{};
+
+    return _world.createEntityWith(.{
+        transform,
+        Mesh{
+            .handle = handle,
+        },
+        try toPhong(renderer, material),
+    });
+}
+
+/// Applies the first material of a loaded model to the entities that draw it.
+pub fn onMeshLoaded(
+    event: MeshLoaded,
+    meshes: Query(&.{ Mesh, Phong }),
+    param: SystemParam,
+) !void {
+    if (event.materials.len == 0) {
+        return;
+    }
+
+    const render_resource = param.world.getResource(render.ecs.resources.Render) orelse unreachable;
+    const phong = try toPhong(render_resource.renderer, event.materials[0]);
+
+    var entities = meshes.getEntities();
+    while (entities.next()) |entity| {
+        const mesh = param.getComponent(Mesh, entity.*) orelse continue;
+        if (!mesh.handle.eql(event.handle)) {
+            continue;
+        }
+
+        const material = param.getComponent(Phong, entity.*) orelse continue;
+        material.* = phong;
+    }
+}
+
+/// The textures are placeholders until they are loaded.
 fn toPhong(renderer: *Renderer, material: Material) !Phong {
     return .{
         .diffuse = try loadTexture(renderer, material.diffuse_texture),
@@ -81,5 +118,5 @@ fn toPhong(renderer: *Renderer, material: Material) !Phong {
 
 fn loadTexture(renderer: *Renderer, path: ?[]const u8) !Texture {
     const _path = path orelse return renderer.textures.default;
-    return try renderer.loadTextureOrDefault(_path);
+    return try renderer.assets.loadImage(renderer, _path);
 }
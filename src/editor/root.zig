@@ -1,4 +1,5 @@
 const core = @import("core");
+const platform = @import("platform");
 const render = @import("render");
 const std = @import("std");
 const systems = @import("systems.zig");
@@ -34,17 +35,29 @@ pub const Editor = struct {
         });
 
         _ = try world.registerSystem(systems.startup, .startup);
-        _ = try world.registerSystem(systems.updateCamera, .update);
-        _ = try world.registerSystem(systems.orbit, .update);
+        // Submits the view transform to bgfx.
+        _ = try world.registerSystemWith(systems.updateCamera, .update, .{
+            .main_thread = true,
+            .reads = &.{
+                platform.ecs.resources.Frame,
+                platform.input.resources.Keyboard,
+                platform.input.resources.Mouse,
+            },
+            .writes = &.{ platform.ecs.resources.Platform, render.ecs.resources.Render },
+        });
+        _ = try world.registerSystemWith(systems.orbit, .update, .{
+            .reads = &.{ resources.Orbit, platform.ecs.resources.Frame },
+        });
         try world.registerEventListener(events.onResetCamera);
         try world.registerEventListener(events.onLoadAssets);
+        try world.registerEventListener(events.onMeshLoaded);
 
         const transform: _world.components.core.Transform = .{
             .translation = components.Camera.default_pos,
             .rotation = Vec.forward.toRotation(),
         };
 
-        const camera = world.createEntity();
+        const camera = try world.createEntity();
         try world.insertComponent(_world.components.core.Transform, camera, transform);
         try world.insertComponent(components.Camera, camera, .{});
 
@@ -58,6 +71,16 @@ pub const Editor = struct {
         _ = self;
     }
 
+    /// Loads the model at the given absolute path in the background. See 'events.addModel'.
+    pub fn addModel(self: *Self, path: []const u8, position: Vec) !Entity {
+        const render_resource = self.world.getResource(render.ecs.resources.Render) orelse
+            unreachable;
+
+        return events.addModel(self.world, render_resource.renderer, path, .{
+            .translation = position,
+        });
+    }
+
     pub fn addPointLight(self: *Self, position: Vec, color: Color4b) !Entity {
         const entity = try self.world.createEntityWith(.{
             _world.components.core.Transform{
@@ -29,6 +29,10 @@ pub fn init(renderer: *Renderer) Self {
 }
 
 pub fn begin(self: Self) void {
+    self.renderer.fonts.beginFrame() catch |err| {
+        std.log.warn("Failed to prepare fonts for the frame. Error: {}", .{err});
+    };
+
     clay.setLayoutDimensions(toDimensions(self.renderer.framebuffer_size));
     clay.beginLayout();
 }
@@ -44,14 +48,13 @@ fn onMeasureText(
     user_data: ?*anyopaque,
 ) callconv(.c) clay.Dimensions {
     const fonts: *Fonts = @ptrCast(@alignCast(user_data.?));
-    const font = fonts.getByHandle(.init(config.*.font_id));
-    const size: Vec2f = blk: {
-        if (font) |f| {
-            f.scaleToSize(@floatFromInt(config.*.font_size));
-            break :blk f.measure(text.str());
-        }
-
-        break :blk .zero;
+    const size = fonts.measure(
+        .init(config.*.font_id),
+        @floatFromInt(config.*.font_size),
+        text.str(),
+    ) catch |err| blk: {
+        std.log.warn("Failed to measure text '{s}'. Error: {}", .{ text.str(), err });
+        break :blk Vec2f.zero;
     };
 
     return toDimensions(size);
@@ -111,11 +114,17 @@ fn renderCommand(
             var buffer = blk: {
                 if (maybe_font) |font| {
                     font.scaleToSize(@floatFromInt(text_data.font_size));
-                    break :blk try font.getVertices(
+                    const vertices = try font.getVertices(
                         renderer.allocator,
                         text_data.string_contents.str(),
                         rect.min,
                     );
+
+                    // Upload any new glyphs before the texture is added to the command.
+                    font.flush(renderer) catch |err| {
+                        std.log.warn("Failed to upload glyphs. Error: {}", .{err});
+                    };
+                    break :blk vertices;
                 } else {
                     break :blk try render.shapes.quad(u16, renderer.allocator, rect, color.data);
                 }
@@ -6,6 +6,7 @@ const std = @import("std");
 const Font = render.Font;
 const Renderer = render.Renderer;
 const Texture = render.Texture;
+const Textures = render.Textures;
 
 const Self = @This();
 
@@ -26,8 +27,10 @@ pub const FontSizes = struct {
 colors: Colors = .{},
 font: *const Font,
 font_sizes: FontSizes = .{},
+/// Holds placeholders until the icons are loaded.
 icons: IconMap = .empty,
 _default_texture: Texture,
+_textures: *const Textures,
 
 pub fn init(renderer: *Renderer, font: *const Font) !Self {
     const allocator = renderer.allocator;
@@ -38,8 +41,8 @@ pub fn init(renderer: *Renderer, font: *const Font) !Self {
     var dir = try std.fs.openDirAbsolute(icons_path, .{ .iterate = true });
     defer dir.close();
 
-    const width: usize = 16;
-    const height: usize = 16;
+    const width: u16 = 16;
+    const height: u16 = 16;
     var icons: IconMap = .empty;
 
     var it = dir.iterate();
@@ -47,14 +50,8 @@ pub fn init(renderer: *Renderer, font: *const Font) !Self {
         const path = try std.fs.path.join(allocator, &.{ icons_path, entry.name });
         defer allocator.free(path);
 
-        const contents = try io.loadSVG(allocator, path, width, height);
-        const texture = try renderer.textures.loadBuffer(
-            &renderer.mem_factory,
-            contents,
-            width,
-            height,
-            .rgba8,
-        );
+        // The icons are rasterized in the background.
+        const texture = try renderer.assets.loadSVG(renderer, path, width, height);
 
         const key = try allocator.dupe(u8, std.fs.path.stem(entry.name));
         try icons.put(allocator, key, texture);
@@ -64,6 +61,7 @@ pub fn init(renderer: *Renderer, font: *const Font) !Self {
         .font = font,
         .icons = icons,
         ._default_texture = renderer.textures.default,
+        ._textures = &renderer.textures,
     };
 }
 
@@ -76,5 +74,6 @@ pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
 }
 
 pub fn getIcon(self: Self, name: []const u8) Texture {
-    return self.icons.get(name) orelse self._default_texture;
+    const icon = self.icons.get(name) orelse return self._default_texture;
+    return self._textures.getByHandle(icon.handle) orelse icon;
 }
@@ -0,0 +1,62 @@
+const builtin = @import("builtin");
+const std = @import("std");
+
+/// Read-only view of an entire file. The file is memory-mapped where supported so the contents
+/// are paged in on demand instead of copied. Falls back to reading the file into memory on
+/// Windows.
+const Self = @This();
+
+const use_mmap = builtin.os.tag != .windows and builtin.os.tag != .wasi;
+
+data: []const u8,
+_mapping: ?[]align(std.heap.page_size_min) const u8 = null,
+_owned: ?[]u8 = null,
+
+pub fn init(allocator: std.mem.Allocator, path: []const u8) !Self {
+    const file = try std.fs.cwd().openFile(path, .{});
+    defer file.close();
+
+    const size = try file.getEndPos();
+    if (size == 0) {
+        return .{
+            .data = &.{},
+        };
+    }
+
+    if (use_mmap) {
+        const mapping = try std.posix.mmap(
+            null,
+            size,
+            std.posix.PROT.READ,
+            .{ .TYPE = .PRIVATE },
+            file.handle,
+            0,
+        );
+
+        return .{
+            .data = mapping,
+            ._mapping = mapping,
+        };
+    }
+
+    const owned = try allocator.alloc(u8, size);
+    errdefer allocator.free(owned);
+
+    const len = try file.readAll(owned);
+    return .{
+        .data = owned[0..len],
+        ._owned = owned,
+    };
+}
+
+pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
+    if (self._mapping) |mapping| {
+        std.posix.munmap(mapping);
+    }
+
+    if (self._owned) |owned| {
+        allocator.free(owned);
+    }
+
+    self.* = undefined;
+}
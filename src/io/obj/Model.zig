@@ -5,13 +5,17 @@ const std = @import("std");
 
 const Vec = core.math.Vec;
 
-const LineReader = io.LineReader;
+const MappedFile = io.MappedFile;
 
 const Material = obj.Material;
 
-/// Represents a single model defined in an obj file.
+/// Represents a single model defined in an obj file. The elements of all faces are stored in a
+/// single array, with 'face_offsets' marking where each face begins.
 const Self = @This();
 
+/// Files smaller than this are parsed on the calling thread.
+const min_chunk_size: usize = 256 * 1024;
+
 pub const Face = struct {
     pub const Element = struct {
         vertex: u32 = 0,
@@ -19,36 +23,25 @@ pub const Face = struct {
         normal: u32 = 0,
     };
 
-    elements: std.ArrayList(Element),
-
-    pub fn init(allocator: std.mem.Allocator) !Face {
-        return .{
-            // Faces must at least have 3 elements to define a triangle.
-            .elements = try .initCapacity(allocator, 3),
-        };
-    }
+    elements: []const Element,
 
-    pub fn deinit(self: *Face, allocator: std.mem.Allocator) void {
-        self.elements.deinit(allocator);
+    pub fn len(self: Face) usize {
+        return self.elements.len;
     }
 
     pub fn get(self: Face, index: usize) ?Element {
-        if (self.elements.items.len == 0 or index >= self.elements.items.len) {
+        if (index >= self.elements.len) {
             return null;
         }
 
-        return self.elements.items[index];
+        return self.elements[index];
     }
 
     /// Returns a face element with the indices subtracted by 1 to match the array
     /// position.
     pub fn getTransformed(self: Face, index: usize) ?Element {
         if (self.get(index)) |element| {
-            return .{
-                .vertex = element.vertex -% 1,
-                .texture = element.texture -% 1,
-                .normal = element.normal -% 1,
-            };
+            return transform(element);
         }
 
         return null;
@@ -68,44 +61,76 @@ pub const Face = struct {
         const element = self.get(index) orelse return null;
         return element.normal -% 1;
     }
+
+    pub fn transform(element: Element) Element {
+        return .{
+            .vertex = element.vertex -% 1,
+            .texture = element.texture -% 1,
+            .normal = element.normal -% 1,
+        };
+    }
+};
+
+pub const Options = struct {
+    /// Parses the chunks on the given pool, with the calling thread helping. The pool may be the
+    /// one the caller is running on.
+    pool: ?*std.Thread.Pool = null,
+    /// The number of chunks parsed at once. Without a pool, a thread is spawned for each chunk
+    /// after the first. Null uses the pool's threads plus the calling thread, or parses on the
+    /// calling thread if there is no pool.
+    threads: ?usize = null,
 };
 
 vertices: std.ArrayList(Vec),
 tex_coords: std.ArrayList(Vec),
 normals: std.ArrayList(Vec),
-faces: std.ArrayList(Face),
+elements: std.ArrayList(Face.Element),
+/// The index of the first element of each face, plus a final entry holding the total number of
+/// elements.
+face_offsets: std.ArrayList(u32),
 materials: std.ArrayList(Material),
+/// The material libraries referenced by the model.
+material_paths: std.ArrayList([]const u8),
 
+/// Memory-maps the file and parses it on the calling thread.
 pub fn loadFile(allocator: std.mem.Allocator, path: []const u8) !Self {
-    var reader: LineReader = try .initFile(allocator, path);
-    defer reader.deinit(allocator);
+    return loadFileWith(allocator, path, .{});
+}
 
-    var result = try process(allocator, &reader);
-    defer result.deinit(allocator);
+/// Same as 'loadFile', but may parse the file in parallel. The allocator must be thread-safe.
+pub fn loadFileWith(allocator: std.mem.Allocator, path: []const u8, options: Options) !Self {
+    var file: MappedFile = try .init(allocator, path);
+    defer file.deinit(allocator);
 
-    try result.loadMaterials(allocator, path, &result.model);
+    var result = try process(allocator, file.data, options);
+    errdefer result.deinit(allocator);
 
-    return result.model;
+    try result.loadMaterials(allocator, path);
+
+    return result;
 }
 
 pub fn loadData(allocator: std.mem.Allocator, data: []const u8) !Self {
-    var reader: LineReader = .initFixed(data);
+    var result = try process(allocator, data, .{});
+    errdefer result.deinit(allocator);
 
-    var result = try process(allocator, &reader);
-    defer result.deinit(allocator);
+    try result.loadMaterials(allocator, "");
 
-    try result.loadMaterials(allocator, "", &result.model);
-
-    return result.model;
+    return result;
 }
 
 pub fn init(allocator: std.mem.Allocator) !Self {
+    var face_offsets: std.ArrayList(u32) = try .initCapacity(allocator, 1);
+    face_offsets.appendAssumeCapacity(0);
+
     return .{
         .vertices = try .initCapacity(allocator, 0),
         .tex_coords = try .initCapacity(allocator, 0),
         .normals = try .initCapacity(allocator, 0),
-        .faces = try .initCapacity(allocator, 0),
+        .elements = try .initCapacity(allocator, 0),
+        .face_offsets = face_offsets,
         .materials = try .initCapacity(allocator, 0),
+        .material_paths = try .initCapacity(allocator, 0),
     };
 }
 
@@ -113,24 +138,34 @@ pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
     self.vertices.deinit(allocator);
     self.tex_coords.deinit(allocator);
     self.normals.deinit(allocator);
-
-    for (self.faces.items) |*face| {
-        face.deinit(allocator);
-    }
-    self.faces.deinit(allocator);
+    self.elements.deinit(allocator);
+    self.face_offsets.deinit(allocator);
 
     for (self.materials.items) |*material| {
         material.deinit(allocator);
     }
     self.materials.deinit(allocator);
+
+    for (self.material_paths.items) |path| {
+        allocator.free(path);
+    }
+    self.material_paths.deinit(allocator);
+}
+
+pub fn numFaces(self: Self) usize {
+    return self.face_offsets.items.len - 1;
 }
 
 pub fn getFace(self: Self, face: usize) ?Face {
-    if (self.faces.items.len == 0 or face >= self.faces.items.len) {
+    if (face >= self.numFaces()) {
         return null;
     }
 
-    return self.faces.items[face];
+    const start = self.face_offsets.items[face];
+    const end = self.face_offsets.items[face + 1];
+    return .{
+        .elements = self.elements.items[start..end],
+    };
 }
 
 pub fn getVertex(self: Self, index: usize) ?Vec {
@@ -178,73 +213,269 @@ pub fn getNormalFace(self: Self, face: usize, index: usize) ?Vec {
     return self.getNormal(normal);
 }
 
-fn process(allocator: std.mem.Allocator, reader: *LineReader) !ProcessResult {
-    var result: ProcessResult = try .init(allocator);
+/// Loads the materials from the referenced material libraries. Relative paths are resolved
+/// against the directory of the model.
+pub fn loadMaterials(self: *Self, allocator: std.mem.Allocator, model_path: []const u8) !void {
+    try loadMaterialLibraries(allocator, model_path, self.material_paths.items, &self.materials);
+}
 
-    while (try reader.readLine()) |line| {
-        try processLine(allocator, &result, line);
+/// Loads the materials from the given material libraries into 'materials'. Libraries that fail to
+/// load are skipped with a warning.
+pub fn loadMaterialLibraries(
+    allocator: std.mem.Allocator,
+    model_path: []const u8,
+    paths: []const []const u8,
+    materials: *std.ArrayList(Material),
+) !void {
+    const directory = if (std.fs.path.dirname(model_path)) |model_dir|
+        try allocator.dupe(u8, model_dir)
+    else
+        try std.fs.cwd().realpathAlloc(allocator, ".");
+    defer allocator.free(directory);
+
+    for (paths) |path| {
+        const materials_or_error = blk: {
+            if (std.fs.path.isAbsolute(path)) {
+                break :blk Material.loadFile(allocator, path);
+            } else {
+                const full_path = try std.fs.path.join(allocator, &.{ directory, path });
+                defer allocator.free(full_path);
+
+                break :blk Material.loadFile(allocator, full_path);
+            }
+        };
+
+        const loaded = materials_or_error catch |err| {
+            std.log.warn("Failed to load material '{s}'. Error: {}", .{ path, err });
+            continue;
+        };
+
+        defer allocator.free(loaded);
+
+        try materials.appendSlice(allocator, loaded);
     }
+}
 
-    return result;
+/// Splits the data into chunks at line boundaries and parses the chunks in parallel. The results
+/// are concatenated in file order, so indices are the same as a serial parse.
+fn process(allocator: std.mem.Allocator, data: []const u8, options: Options) !Self {
+    const max_threads = options.threads orelse if (options.pool) |pool| pool.threads.len + 1 else 1;
+    const num_chunks = std.math.clamp(data.len / min_chunk_size, 1, @max(max_threads, 1));
+    return processChunks(allocator, data, num_chunks, options.pool);
 }
 
-fn processLine(
+fn processChunks(
     allocator: std.mem.Allocator,
-    result: *ProcessResult,
-    line: []const u8,
-) !void {
-    if (line.len == 0) {
-        return;
+    data: []const u8,
+    num_chunks: usize,
+    pool: ?*std.Thread.Pool,
+) !Self {
+    const chunks = try allocator.alloc(Chunk, num_chunks);
+    defer allocator.free(chunks);
+
+    var start: usize = 0;
+    for (chunks, 0..) |*chunk, i| {
+        var end = if (i == num_chunks - 1) data.len else data.len / num_chunks * (i + 1);
+        end = @max(end, start);
+        if (std.mem.indexOfScalarPos(u8, data, end, '\n')) |newline| {
+            end = if (i == num_chunks - 1) data.len else newline + 1;
+        } else {
+            end = data.len;
+        }
+
+        chunk.* = .{
+            .data = data[start..end],
+        };
+        start = end;
+    }
+    defer for (chunks) |*chunk| {
+        chunk.deinit(allocator);
+    };
+
+    if (num_chunks == 1) {
+        chunks[0].parse(allocator);
+    } else if (pool) |pool_| {
+        var wait_group: std.Thread.WaitGroup = .{};
+        for (chunks[1..]) |*chunk| {
+            pool_.spawnWg(&wait_group, Chunk.parse, .{ chunk, allocator });
+        }
+
+        chunks[0].parse(allocator);
+        pool_.waitAndWork(&wait_group);
+    } else {
+        const threads = try allocator.alloc(std.Thread, num_chunks - 1);
+        defer allocator.free(threads);
+
+        var spawned: usize = 0;
+        defer for (threads[0..spawned]) |thread| {
+            thread.join();
+        };
+
+        for (chunks[1..], threads) |*chunk, *thread| {
+            thread.* = std.Thread.spawn(.{}, Chunk.parse, .{ chunk, allocator }) catch {
+                // Parse the remaining chunks on this thread.
+                chunk.parse(allocator);
+                continue;
+            };
+            spawned += 1;
+        }
+
+        chunks[0].parse(allocator);
+    }
+
+    for (chunks) |chunk| {
+        if (chunk.err) |err| {
+            return err;
+        }
     }
 
-    const element = line[0];
-    switch (element) {
-        '#' => {},
-        'v' => {
-            switch (line[1]) {
-                // Ignore normal and texture coordinates for now.
-                'n' => {
-                    const normal = processVec3(line);
-                    try result.model.normals.append(allocator, normal);
-                },
-                't' => {
-                    const texture_coord = processVec3(line);
-                    try result.model.tex_coords.append(allocator, texture_coord);
-                },
-                'p' => {
-                    // Currently not supported.
-                    // TODO: Emit a single warning if this element is found.
-                },
-                // If the next character is not one of the above, then assume
-                // it is a vertex.
-                else => {
-                    const vertex = processVertex(line);
-                    try result.model.vertices.append(allocator, vertex);
-                },
+    return merge(allocator, chunks);
+}
+
+fn merge(allocator: std.mem.Allocator, chunks: []const Chunk) !Self {
+    var result: Self = try .init(allocator);
+    errdefer result.deinit(allocator);
+
+    var num_vertices: usize = 0;
+    var num_tex_coords: usize = 0;
+    var num_normals: usize = 0;
+    var num_elements: usize = 0;
+    var num_faces: usize = 0;
+    for (chunks) |chunk| {
+        num_vertices += chunk.vertices.items.len;
+        num_tex_coords += chunk.tex_coords.items.len;
+        num_normals += chunk.normals.items.len;
+        num_elements += chunk.elements.items.len;
+        num_faces += chunk.face_sizes.items.len;
+    }
+
+    if (num_elements > std.math.maxInt(u32)) {
+        return error.Overflow;
+    }
+
+    try result.vertices.ensureTotalCapacityPrecise(allocator, num_vertices);
+    try result.tex_coords.ensureTotalCapacityPrecise(allocator, num_tex_coords);
+    try result.normals.ensureTotalCapacityPrecise(allocator, num_normals);
+    try result.elements.ensureTotalCapacityPrecise(allocator, num_elements);
+    try result.face_offsets.ensureTotalCapacityPrecise(allocator, num_faces + 1);
+
+    var offset: u32 = 0;
+    for (chunks) |chunk| {
+        result.vertices.appendSliceAssumeCapacity(chunk.vertices.items);
+        result.tex_coords.appendSliceAssumeCapacity(chunk.tex_coords.items);
+        result.normals.appendSliceAssumeCapacity(chunk.normals.items);
+        result.elements.appendSliceAssumeCapacity(chunk.elements.items);
+
+        for (chunk.face_sizes.items) |size| {
+            offset += size;
+            result.face_offsets.appendAssumeCapacity(offset);
+        }
+
+        for (chunk.material_paths.items) |path| {
+            const owned = try allocator.dupe(u8, path);
+            errdefer allocator.free(owned);
+            try result.material_paths.append(allocator, owned);
+        }
+    }
+
+    return result;
+}
+
+/// The results of parsing a range of lines. Material paths point into the parsed data.
+const Chunk = struct {
+    data: []const u8,
+    vertices: std.ArrayList(Vec) = .empty,
+    tex_coords: std.ArrayList(Vec) = .empty,
+    normals: std.ArrayList(Vec) = .empty,
+    elements: std.ArrayList(Face.Element) = .empty,
+    face_sizes: std.ArrayList(u32) = .empty,
+    material_paths: std.ArrayList([]const u8) = .empty,
+    err: ?anyerror = null,
+
+    fn deinit(self: *Chunk, allocator: std.mem.Allocator) void {
+        self.vertices.deinit(allocator);
+        self.tex_coords.deinit(allocator);
+        self.normals.deinit(allocator);
+        self.elements.deinit(allocator);
+        self.face_sizes.deinit(allocator);
+        self.material_paths.deinit(allocator);
+    }
+
+    fn parse(self: *Chunk, allocator: std.mem.Allocator) void {
+        self.parseLines(allocator) catch |err| {
+            self.err = err;
+        };
+    }
+
+    fn parseLines(self: *Chunk, allocator: std.mem.Allocator) !void {
+        var start: usize = 0;
+        while (start < self.data.len) {
+            const end = std.mem.indexOfScalarPos(u8, self.data, start, '\n') orelse self.data.len;
+            var line = self.data[start..end];
+            start = end + 1;
+
+            // Check if there is a trailing carriage return and adjust line.
+            if (line.len > 0 and line[line.len - 1] == '\r') {
+                line.len -= 1;
             }
-        },
-        'f' => {
-            const face = try processFace(allocator, line);
-            try result.model.faces.append(allocator, face);
-        },
-        else => {
-            if (std.mem.indexOf(u8, line, " ")) |index| {
-                const token = line[0..index];
-
-                if (std.mem.eql(u8, token, "mtllib")) {
-                    var tokens = std.mem.tokenizeAny(u8, line, " ");
-
-                    // Skip the 'mtllib' token
-                    _ = tokens.next();
-
-                    if (tokens.next()) |file| {
-                        try result.material_paths.append(allocator, try allocator.dupe(u8, file));
+
+            try self.processLine(allocator, line);
+        }
+    }
+
+    fn processLine(self: *Chunk, allocator: std.mem.Allocator, line: []const u8) !void {
+        if (line.len < 2) {
+            return;
+        }
+
+        const element = line[0];
+        switch (element) {
+            '#' => {},
+            'v' => {
+                switch (line[1]) {
+                    'n' => {
+                        const normal = processVec3(line);
+                        try self.normals.append(allocator, normal);
+                    },
+                    't' => {
+                        const texture_coord = processVec3(line);
+                        try self.tex_coords.append(allocator, texture_coord);
+                    },
+                    'p' => {
+                        // Currently not supported.
+                        // TODO: Emit a single warning if this element is found.
+                    },
+                    // If the next character is not one of the above, then assume
+                    // it is a vertex.
+                    else => {
+                        const vertex = processVertex(line);
+                        try self.vertices.append(allocator, vertex);
+                    },
+                }
+            },
+            'f' => {
+                const size = try processFace(allocator, &self.elements, line);
+                try self.face_sizes.append(allocator, size);
+            },
+            else => {
+                if (std.mem.indexOf(u8, line, " ")) |index| {
+                    const token = line[0..index];
+
+                    if (std.mem.eql(u8, token, "mtllib")) {
+                        var tokens = std.mem.tokenizeAny(u8, line, " ");
+
+                        // Skip the 'mtllib' token
+                        _ = tokens.next();
+
+                        if (tokens.next()) |file| {
+                            try self.material_paths.append(allocator, file);
+                        }
                     }
                 }
-            }
-        },
+            },
+        }
     }
-}
+};
 
 fn processVertex(line: []const u8) Vec {
     var it = std.mem.tokenizeAny(u8, line, " ");
@@ -271,20 +502,26 @@ fn processVec3(line: []const u8) Vec {
     return .init(x, y, z, 1.0);
 }
 
-fn processFace(allocator: std.mem.Allocator, line: []const u8) !Face {
+/// Appends the elements of the face to the given list and returns the number of elements.
+fn processFace(
+    allocator: std.mem.Allocator,
+    elements: *std.ArrayList(Face.Element),
+    line: []const u8,
+) !u32 {
     var it = std.mem.tokenizeAny(u8, line, " ");
 
     // Skip the 'f' character.
     _ = it.next();
 
-    var result: Face = try .init(allocator);
+    var result: u32 = 0;
     while (it.next()) |token| {
         const indices = processFaceIndices(token);
-        try result.elements.append(allocator, .{
+        try elements.append(allocator, .{
             .vertex = indices[0],
             .texture = indices[1],
             .normal = indices[2],
         });
+        result += 1;
     }
 
     return result;
@@ -327,60 +564,6 @@ fn processFaceIndices(indices: []const u8) [3]u32 {
     return result;
 }
 
-const ProcessResult = struct {
-    model: Self,
-    material_paths: std.ArrayList([]const u8),
-
-    fn init(allocator: std.mem.Allocator) !ProcessResult {
-        return .{
-            .model = try .init(allocator),
-            .material_paths = try .initCapacity(allocator, 0),
-        };
-    }
-
-    fn deinit(self: *ProcessResult, allocator: std.mem.Allocator) void {
-        for (self.material_paths.items) |path| {
-            allocator.free(path);
-        }
-        self.material_paths.deinit(allocator);
-    }
-
-    fn loadMaterials(
-        self: *ProcessResult,
-        allocator: std.mem.Allocator,
-        model_path: []const u8,
-        model: *Self,
-    ) !void {
-        const directory = if (std.fs.path.dirname(model_path)) |model_dir|
-            try allocator.dupe(u8, model_dir)
-        else
-            try std.fs.cwd().realpathAlloc(allocator, ".");
-        defer allocator.free(directory);
-
-        for (self.material_paths.items) |path| {
-            const materials_or_error = blk: {
-                if (std.fs.path.isAbsolute(path)) {
-                    break :blk Material.loadFile(allocator, path);
-                } else {
-                    const full_path = try std.fs.path.join(allocator, &.{ directory, path });
-                    defer allocator.free(full_path);
-
-                    break :blk Material.loadFile(allocator, full_path);
-                }
-            };
-
-            const materials = materials_or_error catch |err| {
-                std.log.warn("Failed to load material '{s}'. Error: {}", .{ path, err });
-                continue;
-            };
-
-            defer allocator.free(materials);
-
-            try model.materials.appendSlice(allocator, materials);
-        }
-    }
-};
-
 test "parse obj data" {
     const data =
         \\v 1.000000 1.000000 1.000000
@@ -436,3 +619,51 @@ test "parse obj data" {
     const no_tex_coord = model.getTextureCoordFace(1, 0);
     try std.testing.expectEqual(null, no_tex_coord);
 }
+
+test "parse obj data in chunks" {
+    const data =
+        \\mtllib first.mtl
+        \\v 1.0 1.0 1.0
+        \\v 2.0 2.0 2.0
+        \\v 3.0 3.0 3.0
+        \\v 4.0 4.0 4.0
+        \\vn 0.0 1.0 0.0
+        \\f 1//1 2//1 3//1
+        \\f 1//1 3//1 4//1 2//1
+        \\mtllib second.mtl
+        \\f 4//1 3//1 2//1
+        \\
+    ;
+
+    const allocator = std.testing.allocator;
+    var serial = try processChunks(allocator, data, 1, null);
+    defer serial.deinit(allocator);
+
+    var chunked = try processChunks(allocator, data, 4, null);
+    defer chunked.deinit(allocator);
+
+    var pool: std.Thread.Pool = undefined;
+    try pool.init(.{ .allocator = allocator, .n_jobs = 2 });
+    defer pool.deinit();
+
+    var pooled = try processChunks(allocator, data, 4, &pool);
+    defer pooled.deinit(allocator);
+    try std.testing.expectEqualSlices(u32, serial.face_offsets.items, pooled.face_offsets.items);
+
+    try std.testing.expectEqual(3, chunked.numFaces());
+    try std.testing.expectEqualSlices(u32, &.{ 0, 3, 7, 10 }, chunked.face_offsets.items);
+    try std.testing.expectEqualSlices(u32, serial.face_offsets.items, chunked.face_offsets.items);
+    try std.testing.expectEqualSlices(
+        Face.Element,
+        serial.elements.items,
+        chunked.elements.items,
+    );
+    try std.testing.expectEqual(serial.vertices.items.len, chunked.vertices.items.len);
+    for (serial.vertices.items, chunked.vertices.items) |expected, actual| {
+        try std.testing.expect(expected.eql(actual));
+    }
+
+    try std.testing.expectEqual(2, chunked.material_paths.items.len);
+    try std.testing.expectEqualStrings("first.mtl", chunked.material_paths.items[0]);
+    try std.testing.expectEqualStrings("second.mtl", chunked.material_paths.items[1]);
+}
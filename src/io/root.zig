@@ -2,6 +2,7 @@ const lunasvg = @import("lunasvg");
 const std = @import("std");
 
 pub const LineReader = @import("LineReader.zig");
+pub const MappedFile = @import("MappedFile.zig");
 pub const obj = @import("obj/root.zig");
 pub const pnm = @import("pnm.zig");
 
@@ -15,10 +15,8 @@ const zglfw = @import("zglfw");
 
 const commandline = core.commandline;
 const Editor = editor.Editor;
-const Entity = world.Entity;
 const GUI = gui.GUI;
 const Mat = core.math.Mat;
-const Model = io.obj.Model;
 const Renderer = render.Renderer;
 const Vec = core.math.Vec;
 const World = world.World;
@@ -48,6 +46,11 @@ pub fn main() !void {
         allocator.destroy(the_world);
     }
 
+    var pool: std.Thread.Pool = undefined;
+    try pool.init(.{ .allocator = allocator });
+    defer pool.deinit();
+    the_world.setThreadPool(&pool);
+
     try platform.init(the_world);
     const platform_resource = the_world.getResource(platform.ecs.resources.Platform).?;
     const mouse = the_world.getResource(platform.input.resources.Mouse).?;
@@ -105,17 +108,13 @@ pub fn main() !void {
     var _editor: Editor = try .init(the_world);
     defer _editor.deinit();
 
-    const entities = loadCommandLineModels(renderer, the_world) catch |err| {
+    loadCommandLineModels(allocator, &_editor) catch |err| {
         std.debug.panic(
             "There was an error trying to load models from the command-line. Error: {}",
             .{err},
         );
     };
 
-    if (entities) |_entities| {
-        allocator.free(_entities);
-    }
-
     _ = try _editor.addPointLight(.init3(1.0, 1.0, 0.0), .init(0, 128, 0, 255));
     try _editor.addDirectionalLight(Vec.up.mul(-1.0));
     the_world.runSystems(.startup);
@@ -146,77 +145,22 @@ fn printBGFXInfo() void {
     std.log.info("Transient Max Index Size: {}", .{caps.*.limits.transientIbSize});
 }
 
-// TODO: Move to 'editor' module.
-fn loadCommandLineModels(renderer: *Renderer, _world: *World) !?[]Entity {
-    const allocator = renderer.allocator;
-
-    const file_names = try commandline.getArgValues(allocator, "--model") orelse return null;
+/// The models are loaded in the background and appear once they are uploaded.
+fn loadCommandLineModels(allocator: std.mem.Allocator, _editor: *Editor) !void {
+    const file_names = try commandline.getArgValues(allocator, "--model") orelse return;
     defer allocator.free(file_names);
 
-    var entities: std.ArrayListUnmanaged(Entity) = .empty;
-    errdefer entities.deinit(allocator);
-
     var offset: f32 = 0.0;
     for (file_names) |file_name| {
-        const path = std.fs.cwd().realpathAlloc(renderer.allocator, file_name) catch |err| {
+        const path = std.fs.cwd().realpathAlloc(allocator, file_name) catch |err| {
             std.log.warn("Failed load model file {s}. Error: {}", .{ file_name, err });
             continue;
         };
         defer allocator.free(path);
 
-        var model = try io.obj.Model.loadFile(allocator, path);
-        defer model.deinit(allocator);
-
-        const mesh = try renderer.loadMeshFromModel(model);
-
-        const entity = _world.createEntity();
-        try _world.insertComponent(world.components.core.Transform, entity, .{
-            .translation = .init3(offset, 0.0, 0.0),
-        });
-        try _world.insertComponent(render.ecs.components.Mesh, entity, .{
-            .handle = mesh,
-        });
-
-        if (model.materials.items.len > 0) {
-            const material = model.materials.items[0];
-            const phong: render.ecs.components.Phong = .{
-                .diffuse = try loadTexture(renderer, material.diffuse_texture),
-                .diffuse_color = material.diffuse,
-                .specular = try loadTexture(renderer, material.specular_texture),
-                .specular_color = material.specular,
-                .shininess = material.specular_exponent,
-            };
-            try _world.insertComponent(render.ecs.components.Phong, entity, phong);
-        } else {
-            try _world.insertComponent(render.ecs.components.Color, entity, .{});
-        }
-
-        try entities.append(allocator, entity);
-
+        _ = try _editor.addModel(path, .init3(offset, 0.0, 0.0));
         offset += 2.0;
     }
-
-    if (entities.items.len > 0) {
-        return try entities.toOwnedSlice(allocator);
-    }
-
-    return null;
-}
-
-fn loadTexture(renderer: *Renderer, path: ?[]const u8) !render.Texture {
-    const path_ = path orelse return .{};
-
-    return renderer.textures.loadImageAbsolute(
-        &renderer.mem_factory,
-        path_,
-    ) catch |err| {
-        std.log.warn(
-            "Failed to load texture '{s}'' from model. Error: {}",
-            .{ path_, err },
-        );
-
-        return renderer.textures.default;
-    };
 }
 
 // The code below will ensure that all referenced files will have their
@@ -0,0 +1,443 @@
+const ecs = @import("ecs/root.zig");
+const io = @import("io");
+const render = @import("root.zig");
+const stb = @import("stb");
+const std = @import("std");
+const world = @import("world");
+
+const Material = io.obj.Material;
+const Meshes = render.Meshes;
+const Renderer = render.Renderer;
+const Texture = render.Texture;
+const World = world.World;
+
+/// Loads assets in the background. Files are read and decoded on worker threads, and the results
+/// are uploaded on the main thread by 'update'. Each request returns a handle right away and
+/// requests for the same asset share a single load. An event from 'ecs.events' is triggered once
+/// the GPU has the asset's data.
+///
+/// Requests must be made on the main thread, as that is where handles are generated.
+const Self = @This();
+
+const Kind = enum {
+    image,
+    svg,
+    mesh,
+};
+
+/// The asset a job produces. The handle is reserved when the asset is requested.
+const Asset = union(Kind) {
+    image: Texture.Handle,
+    svg: Svg,
+    mesh: Meshes.Mesh.Handle,
+
+    fn textureHandle(self: Asset) ?Texture.Handle {
+        return switch (self) {
+            .image => |handle| handle,
+            .svg => |svg| svg.handle,
+            .mesh => null,
+        };
+    }
+};
+
+const Svg = struct {
+    handle: Texture.Handle = .invalid,
+    width: u16,
+    height: u16,
+};
+
+/// The data produced by a worker thread.
+const Decoded = union(Kind) {
+    image: stb.image.Image,
+    svg: []u8,
+    mesh: Meshes.FileData,
+};
+
+const State = enum(u8) {
+    /// Waiting for a worker thread.
+    decoding,
+    /// Waiting to be uploaded on the main thread.
+    decoded,
+    /// Waiting for the GPU to consume the data.
+    uploading,
+    /// Loaded or failed.
+    done,
+};
+
+const Job = struct {
+    loader: *Self,
+    path: []const u8,
+    asset: Asset,
+    state: std.atomic.Value(State) = .init(.decoding),
+    /// Written by the worker thread before the state is set to 'decoded'.
+    result: anyerror!Decoded = error.NotDecoded,
+    /// The materials of a mesh. Kept after the mesh is loaded for later requests.
+    materials: std.ArrayList(Material) = .empty,
+};
+
+const JobMap = std.StringHashMapUnmanaged(*Job);
+
+_allocator: std.mem.Allocator,
+_pool: std.Thread.Pool,
+/// Every requested asset by its key. Jobs are kept once they are done, so a repeated request
+/// returns the same handle.
+_jobs: JobMap = .empty,
+/// The jobs that are not done yet. Only accessed on the main thread.
+_pending: std.ArrayList(*Job) = .empty,
+
+pub fn init(allocator: std.mem.Allocator) !*Self {
+    const result = try allocator.create(Self);
+    errdefer allocator.destroy(result);
+
+    result.* = .{
+        ._allocator = allocator,
+        ._pool = undefined,
+    };
+
+    // Leave some of the cores to the systems that run each frame.
+    const cpu_count = std.Thread.getCpuCount() catch 1;
+    try result._pool.init(.{
+        .allocator = allocator,
+        .n_jobs = @max(1, cpu_count / 2),
+    });
+
+    return result;
+}
+
+/// Waits for the worker threads to finish their jobs before freeing them.
+pub fn deinit(self: *Self) void {
+    const allocator = self._allocator;
+    self._pool.deinit();
+
+    var it = self._jobs.iterator();
+    while (it.next()) |entry| {
+        const job = entry.value_ptr.*;
+        if (job.state.load(.acquire) == .decoded) {
+            if (job.result) |*decoded| {
+                freeDecoded(allocator, decoded);
+            } else |_| {}
+        }
+
+        for (job.materials.items) |*material| {
+            material.deinit(allocator);
+        }
+        job.materials.deinit(allocator);
+
+        allocator.free(job.path);
+        allocator.free(entry.key_ptr.*);
+        allocator.destroy(job);
+    }
+    self._jobs.deinit(allocator);
+    self._pending.deinit(allocator);
+}
+
+/// The pool running the loader's jobs. Other work may share it.
+pub fn getPool(self: *Self) *std.Thread.Pool {
+    return &self._pool;
+}
+
+/// Returns the texture for the image at the given absolute path. A placeholder sharing the
+/// default texture's data is returned until the image is loaded. 'TextureLoaded' is triggered
+/// with the same handle once it is.
+pub fn loadImage(self: *Self, renderer: *Renderer, path: []const u8) !Texture {
+    const key = try std.fmt.allocPrint(self._allocator, "image:{s}", .{path});
+    const job = try self.request(key, path, .{ .image = .invalid });
+    return getTexture(renderer, job.asset.image);
+}
+
+/// Same as 'loadImage', but rasterizes the SVG file at the given size.
+pub fn loadSVG(
+    self: *Self,
+    renderer: *Renderer,
+    path: []const u8,
+    width: u16,
+    height: u16,
+) !Texture {
+    const key = try std.fmt.allocPrint(
+        self._allocator,
+        "svg:{}x{}:{s}",
+        .{ width, height, path },
+    );
+    const job = try self.request(key, path, .{ .svg = .{
+        .width = width,
+        .height = height,
+    } });
+    return getTexture(renderer, job.asset.svg.handle);
+}
+
+/// Returns the handle for the mesh in the obj file at the given absolute path. Nothing is drawn
+/// for the handle until the mesh is loaded. 'MeshLoaded' is triggered with its materials once it
+/// is.
+pub fn loadMesh(self: *Self, path: []const u8) !Meshes.Mesh.Handle {
+    const key = try std.fmt.allocPrint(self._allocator, "mesh:{s}", .{path});
+    const job = try self.request(key, path, .{ .mesh = .invalid });
+    return job.asset.mesh;
+}
+
+/// Returns the materials of a mesh requested with 'loadMesh', or null if it is still loading.
+pub fn getMaterials(self: Self, handle: Meshes.Mesh.Handle) ?[]const Material {
+    var it = self._jobs.valueIterator();
+    while (it.next()) |job| {
+        switch (job.*.asset) {
+            .mesh => |mesh| if (mesh.eql(handle)) {
+                if (job.*.state.load(.acquire) != .done) {
+                    return null;
+                }
+                return job.*.materials.items;
+            },
+            else => {},
+        }
+    }
+
+    return null;
+}
+
+/// Uploads the assets that have been decoded and triggers an event for each asset that is now on
+/// the GPU. Must be called on the main thread after the renderer's uploads are updated.
+pub fn update(self: *Self, renderer: *Renderer, _world: *World) void {
+    var i: usize = 0;
+    while (i < self._pending.items.len) {
+        const job = self._pending.items[i];
+        if (takeDecoded(job)) |decoded| {
+            upload(renderer, job, decoded);
+        }
+
+        const state = job.state.load(.acquire);
+        if (state == .uploading and !isUploading(renderer, job)) {
+            job.state.store(.done, .release);
+            // Listeners may request more assets, so the job is removed before the event.
+            _ = self._pending.swapRemove(i);
+            notify(renderer, _world, job);
+        } else if (state == .done) {
+            _ = self._pending.swapRemove(i);
+        } else {
+            i += 1;
+        }
+    }
+}
+
+/// Returns the job for the given key, starting one if the asset hasn't been requested before.
+/// Takes ownership of 'key'.
+fn request(self: *Self, key: []u8, path: []const u8, asset: Asset) !*Job {
+    const allocator = self._allocator;
+
+    if (self._jobs.get(key)) |job| {
+        allocator.free(key);
+        return job;
+    }
+    errdefer allocator.free(key);
+
+    const job = try allocator.create(Job);
+    errdefer allocator.destroy(job);
+
+    const path_ = try allocator.dupe(u8, path);
+    errdefer allocator.free(path_);
+
+    job.* = .{
+        .loader = self,
+        .path = path_,
+        .asset = asset,
+    };
+
+    switch (job.asset) {
+        .image => |*handle| handle.* = .generate(),
+        .svg => |*svg| svg.handle = .generate(),
+        .mesh => |*handle| handle.* = .generate(),
+    }
+
+    try self._jobs.put(allocator, key, job);
+    errdefer _ = self._jobs.remove(key);
+
+    try self._pending.append(allocator, job);
+    errdefer _ = self._pending.pop();
+
+    try self._pool.spawn(decode, .{job});
+    return job;
+}
+
+/// Called on a worker thread.
+fn decode(job: *Job) void {
+    job.result = decodeAsset(job.loader, job.path, job.asset);
+    job.state.store(.decoded, .release);
+}
+
+fn decodeAsset(loader: *Self, path: []const u8, asset: Asset) !Decoded {
+    const allocator = loader._allocator;
+    switch (asset) {
+        .image => {
+            const contents = try io.getContents(allocator, path);
+            defer allocator.free(contents);
+
+            return .{ .image = try stb.image.load_from_memory(contents) };
+        },
+        .svg => |svg| {
+            return .{ .svg = try io.loadSVG(allocator, path, svg.width, svg.height) };
+        },
+        .mesh => {
+            // Models are parsed on the loader's own pool rather than on threads of their own, which
+            // keeps the number of threads fixed no matter how many models are loading.
+            return .{ .mesh = try Meshes.readFile(allocator, path, .{
+                .pool = loader.getPool(),
+            }) };
+        },
+    }
+}
+
+fn freeDecoded(allocator: std.mem.Allocator, decoded: *Decoded) void {
+    switch (decoded.*) {
+        .image => |image| stb.image.free(image),
+        .svg => |data| allocator.free(data),
+        .mesh => |*data| data.deinit(allocator),
+    }
+}
+
+/// Returns the data of a job that has finished decoding. A job that failed to decode is done
+/// without ever reaching the renderer.
+fn takeDecoded(job: *Job) ?Decoded {
+    if (job.state.load(.acquire) != .decoded) {
+        return null;
+    }
+
+    return job.result catch |err| {
+        std.log.warn("Failed to load asset '{s}'. Error: {}", .{ job.path, err });
+        job.state.store(.done, .release);
+        return null;
+    };
+}
+
+/// Hands the decoded data to the renderer, which takes ownership of it. The data is freed here if
+/// the renderer fails to take it.
+fn upload(renderer: *Renderer, job: *Job, decoded: Decoded) void {
+    var owned = decoded;
+    submit(renderer, job, decoded) catch |err| {
+        std.log.warn("Failed to upload asset '{s}'. Error: {}", .{ job.path, err });
+        freeDecoded(job.loader._allocator, &owned);
+        job.state.store(.done, .release);
+        return;
+    };
+
+    job.state.store(.uploading, .release);
+}
+
+fn submit(renderer: *Renderer, job: *Job, decoded: Decoded) !void {
+    switch (decoded) {
+        .image => |image| {
+            _ = try renderer.textures.loadDecodedImage(
+                &renderer.mem_factory,
+                job.asset.image,
+                image,
+            );
+        },
+        .svg => |data| {
+            const svg = job.asset.svg;
+            _ = try renderer.textures.loadBufferWithHandle(
+                &renderer.mem_factory,
+                svg.handle,
+                data,
+                svg.width,
+                svg.height,
+                .rgba8,
+            );
+        },
+        .mesh => |data| {
+            try renderer.meshes.loadFromBufferWithHandle(renderer, job.asset.mesh, data.buffer);
+            // The materials stay with the job for the event and later requests.
+            job.materials = data.materials;
+        },
+    }
+}
+
+fn isUploading(renderer: *Renderer, job: *Job) bool {
+    if (job.asset.textureHandle()) |handle| {
+        return renderer.textures.isUploading(handle);
+    }
+
+    const mesh = renderer.meshes.get(job.asset.mesh) orelse return false;
+    return renderer.isUploading(mesh.buffer);
+}
+
+fn notify(renderer: *Renderer, _world: *World, job: *Job) void {
+    switch (job.asset) {
+        .image, .svg => {
+            const handle = job.asset.textureHandle() orelse unreachable;
+            const texture = renderer.textures.getByHandle(handle) orelse return;
+            _world.triggerEvent(ecs.events.TextureLoaded{
+                .texture = texture,
+            });
+        },
+        .mesh => |handle| {
+            _world.triggerEvent(ecs.events.MeshLoaded{
+                .handle = handle,
+                .path = job.path,
+                .materials = job.materials.items,
+            });
+        },
+    }
+}
+
+/// Returns the texture with the given handle, or a placeholder while it is loading.
+fn getTexture(renderer: *Renderer, handle: Texture.Handle) Texture {
+    if (renderer.textures.getByHandle(handle)) |texture| {
+        return texture;
+    }
+
+    var result = renderer.textures.default;
+    result.handle = handle;
+    return result;
+}
+
+test "requests for the same asset share a load" {
+    const allocator = std.testing.allocator;
+
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+
+    try tmp.dir.writeFile(.{
+        .sub_path = "triangle.obj",
+        .data = "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n",
+    });
+
+    const path = try tmp.dir.realpathAlloc(allocator, "triangle.obj");
+    defer allocator.free(path);
+
+    const loader: *Self = try .init(allocator);
+    defer {
+        loader.deinit();
+        allocator.destroy(loader);
+    }
+
+    const first = try loader.loadMesh(path);
+    const second = try loader.loadMesh(path);
+    try std.testing.expect(first.isValid());
+    try std.testing.expect(first.eql(second));
+    try std.testing.expectEqual(1, loader._pending.items.len);
+
+    // Nothing is on the GPU until 'update' uploads it.
+    try std.testing.expectEqual(null, loader.getMaterials(first));
+}
+
+test "failed loads finish without uploading" {
+    const allocator = std.testing.allocator;
+
+    const loader: *Self = try .init(allocator);
+    defer {
+        loader.deinit();
+        allocator.destroy(loader);
+    }
+
+    const handle = try loader.loadMesh("/missing/model.obj");
+    const job = loader._pending.items[0];
+    while (job.state.load(.acquire) == .decoding) {
+        std.Thread.yield() catch {};
+    }
+    try std.testing.expectError(error.FileNotFound, job.result);
+
+    // A failed job is done before it would be uploaded, so no event is triggered for it.
+    try std.testing.expectEqual(null, takeDecoded(job));
+    try std.testing.expectEqual(.done, job.state.load(.acquire));
+
+    // Later requests share the failed job instead of loading it again.
+    try std.testing.expect(handle.eql(try loader.loadMesh("/missing/model.obj")));
+    try std.testing.expectEqual(1, loader._pending.items.len);
+    try std.testing.expectEqual(0, loader.getMaterials(handle).?.len);
+}
@@ -6,66 +6,45 @@ const Rectus = core.math.Rectus;
 const Vec2f = core.math.Vec2f;
 const Vec2us = core.math.Vec2us;
 
-/// A growable 2D buffer that keeps track of regions of data that have been placed.
-/// Currently, the packing is extremely inefficient as each region is just added in order. If the
-/// given region can't fit, the atlas is resized and all previous regions are packed again
-/// before continuing on.
+/// A growable 2D buffer that packs regions using a skyline with the bottom-left heuristic. The
+/// skyline tracks the lowest free row along the width of the buffer, and each region is placed
+/// where its last row ends up closest to the top. If a region can't fit, the buffer grows and all
+/// previous regions keep their positions.
+///
+/// The areas that changed since the last call to 'clearDirty' are kept in 'dirty' so only those
+/// areas need to be uploaded. If the buffer was resized, 'resized' is set and the whole buffer
+/// must be uploaded instead.
 const Self = @This();
 
 pub const Error = error{
     TooManyIterations,
 };
 
-pub const Cursor = struct {
-    pos: Vec2us = .zero,
-    size: Vec2us = .zero,
-    height: usize = 0,
+/// Dirty regions are merged into their bounds once there are more than this many.
+const max_dirty_regions: usize = 32;
 
-    fn canFit(self: Cursor, size: Vec2us) bool {
-        const max: Vec2us = .init(
-            self.pos.x + size.x - 1,
-            self.pos.y + size.y - 1,
-        );
-
-        if (max.x >= self.size.x) {
-            return false;
-        }
-
-        if (max.y >= self.size.y) {
-            return false;
-        }
-
-        return true;
-    }
-
-    fn ensureFit(self: *Cursor, size: Vec2us) bool {
-        if (!self.canFit(size)) {
-            self.advance(size);
-        }
-
-        return self.canFit(size);
-    }
-
-    fn advance(self: *Cursor, size: Vec2us) void {
-        if (self.canFit(size)) {
-            self.pos.x += size.x;
-        } else {
-            self.pos.x = 0;
-            self.pos.y += self.height;
-            self.height = 0;
-        }
-    }
+/// A horizontal span of the skyline. 'y' is the first free row above the span.
+const Segment = struct {
+    x: usize,
+    y: usize,
+    width: usize,
+};
 
-    fn updateHeight(self: *Cursor, height: usize) void {
-        self.*.height = @max(self.height, height);
-    }
+const Fit = struct {
+    index: usize,
+    y: usize,
 };
 
 buffer: Buffer2D,
+/// The placed regions in the order they were given.
 regions: std.ArrayList(Rectus),
+/// The regions written to since the last call to 'clearDirty'.
+dirty: std.ArrayList(Rectus) = .empty,
+/// True if the buffer has been resized since the last call to 'clearDirty'.
+resized: bool = false,
 base_size: Vec2us = Vec2us.zero,
 resize_scale: Vec2f = .init(2.0, 2.0),
-_cursor: Cursor = .{},
+_skyline: std.ArrayList(Segment) = .empty,
 _allocator: std.mem.Allocator,
 
 pub fn init(allocator: std.mem.Allocator, width: usize, height: usize) !Self {
@@ -76,95 +55,264 @@ pub fn init(allocator: std.mem.Allocator, width: usize, height: usize) !Self {
         0,
     );
     const regions = try std.ArrayList(Rectus).initCapacity(allocator, 0);
+
+    var skyline = try std.ArrayList(Segment).initCapacity(allocator, 1);
+    skyline.appendAssumeCapacity(.{ .x = 0, .y = 0, .width = width });
+
     return Self{
         .buffer = buffer,
         .base_size = .init(width, height),
         .regions = regions,
+        ._skyline = skyline,
         ._allocator = allocator,
-        ._cursor = .{ .size = .init(width, height) },
     };
 }
 
 pub fn deinit(self: *Self) void {
     self.buffer.deinit();
     self.regions.deinit(self._allocator);
+    self.dirty.deinit(self._allocator);
+    self._skyline.deinit(self._allocator);
 }
 
-/// For placing a single pixel, use a size of (0, 0).
-pub fn place(self: *Self, size: Vec2us, data: []const u8) !void {
-    // See if the given region can fit within the current bounds.
-    if (!self._cursor.ensureFit(size)) {
-        var new_size = self.buffer.getSize();
-
-        var iterations: u32 = 0;
-        while (true) {
-            new_size = self.getExpandSize(new_size);
-            if (try self.expandAndRepack(new_size)) {
-                if (self._cursor.ensureFit(size)) {
-                    break;
-                }
-            }
+/// Places the data into the atlas and returns the region it was placed in. For placing a single
+/// pixel, use a size of (0, 0).
+pub fn place(self: *Self, size: Vec2us, data: []const u8) !Rectus {
+    const region = try self.reserve(size);
+    try self.write(region, data);
+    try self.regions.append(self._allocator, region);
+    return region;
+}
+
+/// Places all of the given regions, sorted from tallest to shortest, which packs much tighter
+/// than placing them in an arbitrary order. The regions are still appended to 'regions' in the
+/// given order.
+pub fn placeAll(self: *Self, sizes: []const Vec2us, data: []const []const u8) !void {
+    std.debug.assert(sizes.len == data.len);
+
+    const order = try self._allocator.alloc(usize, sizes.len);
+    defer self._allocator.free(order);
+
+    for (order, 0..) |*index, i| {
+        index.* = i;
+    }
 
-            iterations += 1;
-            if (iterations >= 10) {
-                return Error.TooManyIterations;
+    std.sort.pdq(usize, order, sizes, struct {
+        fn lessThan(context: []const Vec2us, a: usize, b: usize) bool {
+            const size_a = context[a];
+            const size_b = context[b];
+            if (size_a.y != size_b.y) {
+                return size_a.y > size_b.y;
             }
+            return size_a.x > size_b.x;
         }
+    }.lessThan);
+
+    const first = self.regions.items.len;
+    try self.regions.resize(self._allocator, first + sizes.len);
+    errdefer self.regions.shrinkRetainingCapacity(first);
+
+    for (order) |i| {
+        const region = try self.reserve(sizes[i]);
+        try self.write(region, data[i]);
+        self.regions.items[first + i] = region;
     }
+}
 
-    const region: Rectus = .init(
-        self._cursor.pos.x,
-        self._cursor.pos.y,
-        self._cursor.pos.x + size.x -| 1,
-        self._cursor.pos.y + size.y -| 1,
-    );
+/// Returns a new atlas at the base size holding copies of the given regions, placed in order
+/// until their total area would exceed 'max_area'. The new positions are in the result's
+/// 'regions', which holds fewer regions than given if some didn't fit in the area.
+pub fn repack(self: Self, regions: []const Rectus, max_area: usize) !Self {
+    const allocator = self._allocator;
 
-    try self.*.buffer.putRegion(region, data);
-    try self.regions.append(self._allocator, region);
+    var sizes: std.ArrayList(Vec2us) = .empty;
+    defer sizes.deinit(allocator);
+
+    var data: std.ArrayList([]const u8) = .empty;
+    defer {
+        for (data.items) |pixels| {
+            allocator.free(pixels);
+        }
+        data.deinit(allocator);
+    }
+
+    var area: usize = 0;
+    for (regions) |region| {
+        const size: Vec2us = .init(region.width() + 1, region.height() + 1);
+        area += size.x * size.y;
+        if (area > max_area) {
+            break;
+        }
+
+        try data.ensureUnusedCapacity(allocator, 1);
+        try sizes.append(allocator, size);
+        data.appendAssumeCapacity(try self.buffer.getRegion(region));
+    }
+
+    var result: Self = try .init(allocator, self.base_size.x, self.base_size.y);
+    errdefer result.deinit();
+    result.resize_scale = self.resize_scale;
+    try result.placeAll(sizes.items, data.items);
 
-    self._cursor.updateHeight(size.y);
-    self._cursor.advance(size);
+    return result;
 }
 
-fn expandAndRepack(self: *Self, new_size: Vec2us) !bool {
-    var dst = try Buffer2D.init(self._allocator, new_size.x, new_size.y, 0);
-    defer dst.deinit();
+/// Resets the dirty state once the changes have been uploaded.
+pub fn clearDirty(self: *Self) void {
+    self.dirty.clearRetainingCapacity();
+    self.resized = false;
+}
+
+/// Finds space for a region of the given size, growing the buffer if needed.
+fn reserve(self: *Self, size: Vec2us) !Rectus {
+    // A size of zero is treated as a single pixel.
+    const width = @max(size.x, 1);
+    const height = @max(size.y, 1);
 
-    var dst_regions = try std.ArrayList(Rectus).initCapacity(self._allocator, 0);
-    defer dst_regions.deinit(self._allocator);
+    var iterations: u32 = 0;
+    const fit = while (true) {
+        if (self.findFit(width, height)) |found| {
+            break found;
+        }
 
-    var dst_cursor: Cursor = .{ .size = new_size };
-    for (self.regions.items) |src_region| {
-        const region_size: Vec2us = .init(src_region.width() + 1, src_region.height() + 1);
+        try self.grow(self.getExpandSize(self.buffer.getSize()));
 
-        if (!dst_cursor.ensureFit(region_size)) {
-            return false;
+        iterations += 1;
+        if (iterations >= 10) {
+            return Error.TooManyIterations;
         }
+    };
+
+    const x = self._skyline.items[fit.index].x;
+    try self.addSegment(fit.index, .{ .x = x, .y = fit.y + height, .width = width });
 
-        const dst_region: Rectus = .init(
-            dst_cursor.pos.x,
-            dst_cursor.pos.y,
-            dst_cursor.pos.x + src_region.width(),
-            dst_cursor.pos.y + src_region.height(),
-        );
+    return .init(x, fit.y, x + width - 1, fit.y + height - 1);
+}
 
-        try dst.copyRegion(dst_region, self.buffer, src_region);
+fn write(self: *Self, region: Rectus, data: []const u8) !void {
+    try self.buffer.putRegion(region, data);
 
-        dst_cursor.updateHeight(region_size.y);
-        dst_cursor.advance(region_size);
-        try dst_regions.append(self._allocator, dst_region);
+    // The whole buffer is uploaded after a resize.
+    if (self.resized) {
+        return;
     }
 
-    self.buffer.deinit();
-    self.buffer = try dst.release();
+    if (self.dirty.items.len >= max_dirty_regions) {
+        var bounds = region;
+        for (self.dirty.items) |dirty| {
+            bounds.min.x = @min(bounds.min.x, dirty.min.x);
+            bounds.min.y = @min(bounds.min.y, dirty.min.y);
+            bounds.max.x = @max(bounds.max.x, dirty.max.x);
+            bounds.max.y = @max(bounds.max.y, dirty.max.y);
+        }
 
-    const dst_regions_data = try dst_regions.toOwnedSlice(self._allocator);
-    self.regions.deinit(self._allocator);
-    self.regions = std.ArrayList(Rectus).fromOwnedSlice(dst_regions_data);
+        self.dirty.clearRetainingCapacity();
+        try self.dirty.append(self._allocator, bounds);
+    } else {
+        try self.dirty.append(self._allocator, region);
+    }
+}
 
-    self._cursor = dst_cursor;
+/// Returns the skyline segment to place the region at with the smallest last row. Ties are
+/// broken by the narrowest segment to leave wider gaps for later regions.
+fn findFit(self: Self, width: usize, height: usize) ?Fit {
+    var result: ?Fit = null;
+    var best_bottom: usize = std.math.maxInt(usize);
+    var best_width: usize = std.math.maxInt(usize);
+
+    for (self._skyline.items, 0..) |segment, i| {
+        const y = self.getFitY(i, width) orelse continue;
+        if (y + height > self.buffer.height) {
+            continue;
+        }
 
-    return true;
+        const bottom = y + height;
+        if (bottom < best_bottom or (bottom == best_bottom and segment.width < best_width)) {
+            result = .{ .index = i, .y = y };
+            best_bottom = bottom;
+            best_width = segment.width;
+        }
+    }
+
+    return result;
+}
+
+/// Returns the lowest row a region of the given width can be placed at, starting at the
+/// segment's position. The region rests on the highest segment it spans.
+fn getFitY(self: Self, index: usize, width: usize) ?usize {
+    const segments = self._skyline.items;
+    const x = segments[index].x;
+    if (x + width > self.buffer.width) {
+        return null;
+    }
+
+    var y: usize = 0;
+    var remaining = width;
+    var i = index;
+    while (remaining > 0) : (i += 1) {
+        y = @max(y, segments[i].y);
+        remaining -|= segments[i].width;
+    }
+
+    return y;
+}
+
+/// Inserts the segment at 'index' and shrinks or removes the segments it now covers.
+fn addSegment(self: *Self, index: usize, segment: Segment) !void {
+    try self._skyline.insert(self._allocator, index, segment);
+
+    const end = segment.x + segment.width;
+    const i = index + 1;
+    while (i < self._skyline.items.len) {
+        const next = &self._skyline.items[i];
+        if (next.x >= end) {
+            break;
+        }
+
+        const overlap = end - next.x;
+        if (overlap < next.width) {
+            next.x += overlap;
+            next.width -= overlap;
+            break;
+        }
+
+        _ = self._skyline.orderedRemove(i);
+    }
+
+    self.mergeSegments();
+}
+
+/// Merges neighbouring segments at the same height.
+fn mergeSegments(self: *Self) void {
+    var i: usize = 0;
+    while (i + 1 < self._skyline.items.len) {
+        const segment = &self._skyline.items[i];
+        const next = self._skyline.items[i + 1];
+        if (segment.y == next.y) {
+            segment.width += next.width;
+            _ = self._skyline.orderedRemove(i + 1);
+        } else {
+            i += 1;
+        }
+    }
+}
+
+/// Grows the buffer without moving any of the placed regions.
+fn grow(self: *Self, new_size: Vec2us) !void {
+    const old_width = self.buffer.width;
+    try self.buffer.grow(new_size.x, new_size.y, 0);
+
+    if (new_size.x > old_width) {
+        try self._skyline.append(self._allocator, .{
+            .x = old_width,
+            .y = 0,
+            .width = new_size.x - old_width,
+        });
+        self.mergeSegments();
+    }
+
+    self.resized = true;
+    self.dirty.clearRetainingCapacity();
 }
 
 fn getExpandSize(self: Self, size: Vec2us) Vec2us {
@@ -182,8 +330,8 @@ test "place" {
     var atlas: Self = try .init(allocator, 2, 2);
     defer atlas.deinit();
 
-    try atlas.place(.init(1, 1), &.{1});
-    try atlas.place(.init(2, 1), &.{ 2, 3 });
+    _ = try atlas.place(.init(1, 1), &.{1});
+    _ = try atlas.place(.init(2, 1), &.{ 2, 3 });
     try std.testing.expectEqual(1, try atlas.buffer.get(0, 0));
     try std.testing.expectEqual(0, try atlas.buffer.get(1, 0));
     try std.testing.expectEqual(2, try atlas.buffer.get(0, 1));
@@ -195,10 +343,10 @@ test "placeExpand" {
     var atlas: Self = try .init(allocator, 2, 2);
     defer atlas.deinit();
 
-    try atlas.place(.init(2, 2), &.{ 1, 2, 3, 4 });
+    _ = try atlas.place(.init(2, 2), &.{ 1, 2, 3, 4 });
     try std.testing.expectEqual(4, atlas.buffer.data.items.len);
 
-    try atlas.place(.init(2, 2), &.{ 5, 6, 7, 8 });
+    _ = try atlas.place(.init(2, 2), &.{ 5, 6, 7, 8 });
     try std.testing.expectEqual(16, atlas.buffer.data.items.len);
 
     try std.testing.expectEqual(1, try atlas.buffer.get(0, 0));
@@ -221,13 +369,86 @@ test "placeExpand" {
     var atlas2: Self = try .init(allocator, 2, 2);
     defer atlas2.deinit();
 
-    try atlas2.place(.init(2, 2), &.{ 1, 2, 3, 4 });
+    _ = try atlas2.place(.init(2, 2), &.{ 1, 2, 3, 4 });
     try std.testing.expectEqual(4, atlas2.buffer.data.items.len);
 
-    try atlas2.place(.init(3, 2), &.{ 5, 6, 7, 8, 9, 0 });
+    _ = try atlas2.place(.init(3, 2), &.{ 5, 6, 7, 8, 9, 0 });
     try std.testing.expectEqual(16, atlas2.buffer.data.items.len);
 }
 
+test "placeAll" {
+    const allocator = std.testing.allocator;
+    var atlas: Self = try .init(allocator, 4, 4);
+    defer atlas.deinit();
+
+    // The tallest region is placed first.
+    try atlas.placeAll(
+        &.{ .init(2, 1), .init(2, 4), .init(2, 3) },
+        &.{ &.{ 1, 1 }, &.{ 2, 2, 2, 2, 2, 2, 2, 2 }, &.{ 3, 3, 3, 3, 3, 3 } },
+    );
+
+    try std.testing.expectEqual(16, atlas.buffer.data.items.len);
+    try std.testing.expectEqual(3, atlas.regions.items.len);
+    try std.testing.expectEqual(Rectus.init(2, 3, 3, 3), atlas.regions.items[0]);
+    try std.testing.expectEqual(Rectus.init(0, 0, 1, 3), atlas.regions.items[1]);
+    try std.testing.expectEqual(Rectus.init(2, 0, 3, 2), atlas.regions.items[2]);
+    try std.testing.expectEqual(1, try atlas.buffer.get(3, 3));
+    try std.testing.expectEqual(2, try atlas.buffer.get(1, 3));
+    try std.testing.expectEqual(3, try atlas.buffer.get(2, 2));
+}
+
+test "dirty" {
+    const allocator = std.testing.allocator;
+    var atlas: Self = try .init(allocator, 4, 4);
+    defer atlas.deinit();
+
+    const first = try atlas.place(.init(2, 2), &.{ 1, 2, 3, 4 });
+    try std.testing.expectEqualSlices(Rectus, &.{first}, atlas.dirty.items);
+    try std.testing.expect(!atlas.resized);
+
+    atlas.clearDirty();
+    const second = try atlas.place(.init(1, 1), &.{5});
+    try std.testing.expectEqualSlices(Rectus, &.{second}, atlas.dirty.items);
+
+    // Growing keeps the existing regions in place and marks the whole buffer as changed.
+    atlas.clearDirty();
+    _ = try atlas.place(.init(4, 4), &([_]u8{6} ** 16));
+    try std.testing.expect(atlas.resized);
+    try std.testing.expectEqual(0, atlas.dirty.items.len);
+    try std.testing.expectEqual(1, try atlas.buffer.get(0, 0));
+    try std.testing.expectEqual(4, try atlas.buffer.get(1, 1));
+    try std.testing.expectEqual(5, try atlas.buffer.get(second.min.x, second.min.y));
+}
+
+test "repack" {
+    const allocator = std.testing.allocator;
+    var atlas: Self = try .init(allocator, 4, 4);
+    defer atlas.deinit();
+
+    const a = try atlas.place(.init(2, 2), &.{ 1, 1, 1, 1 });
+    const b = try atlas.place(.init(4, 4), &([_]u8{2} ** 16));
+    const c = try atlas.place(.init(1, 2), &.{ 3, 3 });
+    try std.testing.expect(atlas.buffer.width > 4);
+
+    // Regions are kept in the given order until the area runs out, so 'b' is dropped.
+    var packed_atlas = try atlas.repack(&.{ c, a, b }, 8);
+    defer packed_atlas.deinit();
+
+    try std.testing.expectEqual(4, packed_atlas.buffer.width);
+    try std.testing.expectEqual(4, packed_atlas.buffer.height);
+    try std.testing.expectEqual(2, packed_atlas.regions.items.len);
+    try std.testing.expect(!packed_atlas.resized);
+
+    const new_c = packed_atlas.regions.items[0];
+    const new_a = packed_atlas.regions.items[1];
+    try std.testing.expectEqual(c.width(), new_c.width());
+    try std.testing.expectEqual(c.height(), new_c.height());
+    try std.testing.expectEqual(a.width(), new_a.width());
+    try std.testing.expectEqual(a.height(), new_a.height());
+    try std.testing.expectEqual(3, try packed_atlas.buffer.get(new_c.min.x, new_c.max.y));
+    try std.testing.expectEqual(1, try packed_atlas.buffer.get(new_a.max.x, new_a.max.y));
+}
+
 test "expand" {
     const allocator = std.testing.allocator;
     var atlas: Self = try .init(allocator, 64, 64);
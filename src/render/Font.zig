@@ -4,6 +4,7 @@ const render = @import("root.zig");
 const stb = @import("stb");
 const std = @import("std");
 
+const Rectus = core.math.Rectus;
 const Vec2f = core.math.Vec2f;
 
 const Atlas = render.Atlas;
@@ -16,15 +17,26 @@ const UIVertexBuffer16 = render.UIVertexBuffer16;
 
 const FontInfo = stb.truetype.FontInfo;
 
+/// A font whose glyphs are rasterized the first time they are used. Glyphs are packed into a
+/// persistent atlas and only the newly rasterized glyphs are uploaded to the texture. When the
+/// atlas grows past 'atlas_max_size', the least recently used glyphs are evicted between frames.
 const Self = @This();
 
 pub const Handle = core.Handle(Self);
 
-pub const Range = struct {
-    min: u32,
-    max: u32,
+pub const Error = error{
+    NotLoaded,
 };
 
+/// The size of the atlas when the font is loaded and after glyphs are evicted.
+const atlas_base_size: usize = 256;
+/// The atlas is compacted at the start of the next frame once it grows past this size.
+const atlas_max_size: usize = 2048;
+/// The area of the glyphs kept when the atlas is compacted.
+const atlas_keep_area: usize = atlas_max_size * atlas_max_size / 4;
+
+const replacement_character: u32 = 0xFFFD;
+
 pub const Glyph = struct {
     min: Vec2f = .zero,
     max: Vec2f = .zero,
@@ -32,6 +44,13 @@ pub const Glyph = struct {
     // These are already scaled.
     advance_width: f32 = 0.0,
     left_side_bearing: f32 = 0.0,
+    /// The glyph index within the font, used for kerning. Zero if the font has no glyph for the
+    /// codepoint.
+    index: i32 = 0,
+    /// False for glyphs without a bitmap, such as whitespace.
+    in_atlas: bool = false,
+    /// The frame the glyph was last used in.
+    last_used: u64 = 0,
 
     pub fn width(self: Glyph) f32 {
         return self.max.x - self.min.x;
@@ -44,6 +63,20 @@ pub const Glyph = struct {
     pub fn size(self: Glyph) Vec2f {
         return self.max.sub(self.min);
     }
+
+    fn getRegion(self: Glyph) Rectus {
+        return .init(
+            @intFromFloat(self.min.x),
+            @intFromFloat(self.min.y),
+            @intFromFloat(self.max.x),
+            @intFromFloat(self.max.y),
+        );
+    }
+
+    fn setRegion(self: *Glyph, region: Rectus) void {
+        self.min = .init(@floatFromInt(region.min.x), @floatFromInt(region.min.y));
+        self.max = .init(@floatFromInt(region.max.x), @floatFromInt(region.max.y));
+    }
 };
 pub const GlyphMap = std.AutoHashMap(u32, Glyph);
 
@@ -54,6 +87,21 @@ pub const VMetrics = struct {
     line_gap: f32 = 0.0,
 };
 
+/// A texture replaced by 'flush'. Commands recorded earlier in the frame may still draw with it,
+/// so it is only destroyed once a later frame has begun.
+const Retired = struct {
+    handle: Texture.Handle,
+    frame: u64,
+};
+
+/// The part of the atlas a flush uploads.
+const PendingUpload = union(enum) {
+    /// The texture is recreated at the atlas' size and all of it is uploaded.
+    all,
+    /// Only the regions written since the last flush are uploaded.
+    regions: []const Rectus,
+};
+
 pub const Type = enum {
     bitmap,
     sdf,
@@ -66,6 +114,10 @@ space_advance_width: f32 = 0.0,
 v_metrics: VMetrics = .{},
 glyphs: GlyphMap,
 texture: Texture = .{},
+_type: Type = .bitmap,
+_atlas: ?Atlas = null,
+_frame: u64 = 0,
+_retired: std.ArrayList(Retired) = .empty,
 _info: FontInfo,
 _data: []const u8,
 
@@ -92,8 +144,15 @@ pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
     allocator.free(self._data);
     self.glyphs.clearAndFree();
     self.glyphs.deinit();
+    self._retired.deinit(allocator);
+
+    if (self._atlas) |*atlas| {
+        atlas.deinit();
+    }
 }
 
+/// Sets up the metrics and the texture for the given size. No glyphs are rasterized until they
+/// are used.
 pub fn load(
     self: *Self,
     renderer: *Renderer,
@@ -101,116 +160,141 @@ pub fn load(
     font_type: Type,
 ) !void {
     const allocator = renderer.mem_factory.allocator;
+    try self.setup(allocator, size, font_type);
+
+    if (self.texture.handle.isValid()) {
+        renderer.textures.destroy(self.texture.handle);
+    }
+
+    self.texture = try renderer.textures.createDynamic(
+        allocator,
+        @intCast(atlas_base_size),
+        @intCast(atlas_base_size),
+        .grayscale,
+    );
+}
 
+/// Same as 'load', but only sets up the metrics and the atlas. Glyphs can be measured and
+/// rasterized without a renderer, but there is no texture to draw them with.
+pub fn setup(self: *Self, allocator: std.mem.Allocator, size: f32, font_type: Type) !void {
     const scale = stb.truetype.scaleForPixelHeight(&self._info, size);
 
-    var atlas: Atlas = try .init(allocator, 128, 128);
-    defer atlas.deinit();
+    const metrics = stb.truetype.getFontVMetrics(&self._info);
+    self.v_metrics.scale = scale;
+    self.v_metrics.ascent = @as(f32, @floatFromInt(metrics.ascent)) * scale;
+    self.v_metrics.descent = @as(f32, @floatFromInt(metrics.descent)) * scale;
+    self.v_metrics.line_gap = @as(f32, @floatFromInt(metrics.line_gap)) * scale;
 
-    const range: Range = .{ .min = 0x20, .max = 0xFF };
-    var valid_chars = try std.ArrayList(u32).initCapacity(allocator, 0);
-    defer valid_chars.deinit(allocator);
+    const space_metrics = stb.truetype.getCodepointHMetrics(&self._info, ' ');
+    self.space_advance_width = @as(f32, @floatFromInt(space_metrics.advance_width)) * scale;
 
-    var ch = range.min;
-    while (ch <= range.max) {
-        defer ch += 1;
+    self.size = size;
+    self.scale = 1.0;
+    self._type = font_type;
 
-        const glyph_or_error = switch (font_type) {
-            .bitmap => stb.truetype.getCodepointBitmap(&self._info, scale, scale, ch),
-            .sdf => stb.truetype.getCodepointSDF(&self._info, size, ch, 4, 128, 32.0),
-        };
+    if (self._atlas) |*atlas| {
+        atlas.deinit();
+    }
+    self.glyphs.clearRetainingCapacity();
+    self._atlas = try .init(allocator, atlas_base_size, atlas_base_size);
+}
 
-        const glyph = glyph_or_error catch |err| {
-            switch (err) {
-                stb.truetype.Error.GlyphNotFound => {
-                    if (ch == ' ') {
-                        const metrics = stb.truetype.getCodepointHMetrics(&self._info, ch);
-                        self.space_advance_width =
-                            @as(f32, @floatFromInt(metrics.advance_width)) * scale;
-                    }
-                    continue;
-                },
-                else => std.debug.panic(
-                    "Failed to get bitmap for codepoint {} '{c}'. Error: {}",
-                    .{
-                        ch,
-                        @as(u8, @intCast(ch)),
-                        err,
-                    },
-                ),
+/// Uploads the glyphs rasterized since the last flush. The texture is recreated if the atlas
+/// has changed size. Must be called before the texture is used for drawing. A replaced texture
+/// is kept alive until the next frame since earlier draw commands may still reference it.
+pub fn flush(self: *Self, renderer: *Renderer) !void {
+    self.destroyRetired(renderer);
+
+    const pending = self.getPendingUpload() orelse return;
+    const atlas = &self._atlas.?;
+    const width: u16 = @intCast(atlas.buffer.width);
+    const height: u16 = @intCast(atlas.buffer.height);
+
+    switch (pending) {
+        .all => {
+            if (self.texture.handle.isValid()) {
+                try self._retired.append(renderer.allocator, .{
+                    .handle = self.texture.handle,
+                    .frame = self._frame,
+                });
             }
-        };
-
-        const glyph_data = glyph.data orelse continue;
-        defer {
-            switch (font_type) {
-                .bitmap => stb.truetype.freeBitmap(glyph_data),
-                .sdf => stb.truetype.freeSDF(glyph_data),
+            self.texture = try renderer.textures.createDynamic(
+                renderer.mem_factory.allocator,
+                width,
+                height,
+                .grayscale,
+            );
+
+            const all: Rectus = .init(0, 0, width - 1, height - 1);
+            Textures.update(self.texture, all, atlas.buffer.data.items, atlas.buffer.width);
+        },
+        .regions => |regions| {
+            for (regions) |region| {
+                Textures.update(self.texture, region, atlas.buffer.data.items, atlas.buffer.width);
             }
-        }
-
-        try atlas.place(
-            .init(@intCast(glyph.w), @intCast(glyph.h)),
-            glyph_data,
-        );
+        },
+    }
 
-        try valid_chars.append(allocator, ch);
+    atlas.clearDirty();
+}
 
-        const h_metrics = stb.truetype.getCodepointHMetrics(&self._info, ch);
-        const entry = try self.glyphs.getOrPut(ch);
-        entry.value_ptr.advance_width =
-            @as(f32, @floatFromInt(h_metrics.advance_width)) * scale;
-        entry.value_ptr.left_side_bearing =
-            @as(f32, @floatFromInt(h_metrics.left_side_bearing)) * scale;
-        entry.value_ptr.offset = .init(@floatFromInt(glyph.xoff), @floatFromInt(glyph.yoff));
+/// Returns what 'flush' has to upload for the texture to match the atlas, or null if the font
+/// isn't loaded.
+fn getPendingUpload(self: *const Self) ?PendingUpload {
+    const atlas = if (self._atlas) |*value| value else return null;
+    if (atlas.resized or
+        self.texture.width != atlas.buffer.width or
+        self.texture.height != atlas.buffer.height)
+    {
+        return .all;
     }
 
-    // Set up the glyph map after all glyphs have been placed into the atlas.
-    for (0..valid_chars.items.len) |i| {
-        const char = valid_chars.items[i];
-        const region = atlas.regions.items[i];
-
-        const entry = try self.glyphs.getOrPut(char);
-        entry.value_ptr.*.min = .init(
-            @floatFromInt(region.min.x),
-            @floatFromInt(region.min.y),
-        );
+    return .{ .regions = atlas.dirty.items };
+}
 
-        entry.value_ptr.*.max = .init(
-            @floatFromInt(region.max.x),
-            @floatFromInt(region.max.y),
-        );
+/// Destroys the textures replaced during earlier frames. Those frames have been submitted, so
+/// no draw command refers to them anymore.
+fn destroyRetired(self: *Self, renderer: *Renderer) void {
+    var i: usize = 0;
+    while (i < self._retired.items.len) {
+        const retired = self._retired.items[i];
+        if (retired.frame < self._frame) {
+            renderer.textures.destroy(retired.handle);
+            _ = self._retired.swapRemove(i);
+        } else {
+            i += 1;
+        }
     }
+}
 
-    const metrics = stb.truetype.getFontVMetrics(&self._info);
-    self.v_metrics.scale = scale;
-    self.v_metrics.ascent = @as(f32, @floatFromInt(metrics.ascent)) * scale;
-    self.v_metrics.descent = @as(f32, @floatFromInt(metrics.descent)) * scale;
-    self.v_metrics.line_gap = @as(f32, @floatFromInt(metrics.line_gap)) * scale;
+/// Advances the frame used to track when glyphs are used. If the atlas has grown past its
+/// limit, the most recently used glyphs are packed into a new atlas and the rest are evicted.
+/// Glyph regions only move here, so vertices built during a frame stay valid.
+pub fn beginFrame(self: *Self) !void {
+    self._frame += 1;
 
-    self.size = size;
-    self.scale = 1.0;
+    const atlas = if (self._atlas) |*value| value else return;
+    if (atlas.buffer.width <= atlas_max_size and atlas.buffer.height <= atlas_max_size) {
+        return;
+    }
 
-    var owned = try atlas.buffer.release();
-    self.texture = try renderer.textures.loadBuffer(
-        &renderer.mem_factory,
-        try owned.data.toOwnedSlice(allocator),
-        @intCast(owned.width),
-        @intCast(owned.height),
-        .grayscale,
-    );
+    try self.compact(atlas_keep_area);
 }
 
 /// Caller must free returned buffer.
 pub fn getVertices(
-    self: Self,
+    self: *Self,
     allocator: std.mem.Allocator,
     string: []const u8,
     offset: Vec2f,
 ) !UIVertexBuffer16 {
+    // Rasterize any missing glyphs first as the atlas may grow.
+    try self.cacheGlyphs(string);
+
+    const atlas = if (self._atlas) |*value| value else return Error.NotLoaded;
     const tex_size: Vec2f = .init(
-        @floatFromInt(self.texture.width),
-        @floatFromInt(self.texture.height),
+        @floatFromInt(atlas.buffer.width),
+        @floatFromInt(atlas.buffer.height),
     );
 
     const vertex_count = string.len * 4;
@@ -221,18 +305,26 @@ pub fn getVertices(
     var vertex_offset: u16 = 0;
     var index: usize = 0;
     var cursor: Vec2f = offset;
-    var prev_ch: u32 = 0;
-    for (string) |ch| {
+    var prev_index: i32 = 0;
+    var it: CodepointIterator = .{ .bytes = string };
+    while (it.next()) |ch| {
         if (ch == ' ') {
             cursor.x += self.space_advance_width * self.scale;
-            prev_ch = 0;
+            prev_index = 0;
             continue;
         }
 
         if (self.glyphs.get(ch)) |glyph| {
+            const kern = self.getKernAdvance(prev_index, glyph.index);
+            prev_index = glyph.index;
+
+            if (!glyph.in_atlas) {
+                cursor.x += glyph.advance_width * self.scale;
+                continue;
+            }
+
             const glyph_offset: Vec2f = glyph.offset.mulScalar(self.scale);
             const glyph_size: Vec2f = glyph.size().mulScalar(self.scale);
-            const kern = self.getKernAdvance(prev_ch, ch);
 
             var min: Vec2f = cursor;
             min.x += @as(f32, @floatFromInt(kern)) * self.v_metrics.scale;
@@ -276,20 +368,22 @@ pub fn getVertices(
             index += 6;
 
             cursor.x += glyph.advance_width * self.scale;
-            prev_ch = ch;
         }
     }
 
     return buffer;
 }
 
-pub fn measure(self: Self, text: []const u8) Vec2f {
+/// Rasterizes any glyphs in the text that are missing. Prefer 'Fonts.measure', which caches the
+/// results.
+pub fn measure(self: *Self, text: []const u8) !Vec2f {
+    try self.cacheGlyphs(text);
+
     var result: Vec2f = .zero;
-    var prev_ch: u32 = 0;
-    for (text) |ch| {
+    var it: CodepointIterator = .{ .bytes = text };
+    while (it.next()) |ch| {
         if (ch == ' ') {
             result.x += self.space_advance_width * self.scale;
-            prev_ch = 0;
             continue;
         }
 
@@ -308,8 +402,242 @@ pub fn scaleToSize(self: *Self, size: f32) void {
     self.scale = size / self.size;
 }
 
-fn getKernAdvance(self: Self, a: u32, b: u32) i32 {
-    const glyph_a = stb.truetype.findGlyphIndex(&self._info, a) catch return 0;
-    const glyph_b = stb.truetype.findGlyphIndex(&self._info, b) catch return 0;
-    return stb.truetype.getGlyphKernAdvance(&self._info, glyph_a, glyph_b);
+fn getKernAdvance(self: Self, a: i32, b: i32) i32 {
+    if (a == 0 or b == 0) {
+        return 0;
+    }
+
+    return stb.truetype.getGlyphKernAdvance(&self._info, a, b);
+}
+
+fn cacheGlyphs(self: *Self, text: []const u8) !void {
+    var it: CodepointIterator = .{ .bytes = text };
+    while (it.next()) |ch| {
+        if (ch != ' ') {
+            try self.cacheGlyph(ch);
+        }
+    }
+}
+
+fn cacheGlyph(self: *Self, codepoint: u32) !void {
+    const entry = try self.glyphs.getOrPut(codepoint);
+    if (!entry.found_existing) {
+        entry.value_ptr.* = self.rasterize(codepoint) catch |err| {
+            _ = self.glyphs.remove(codepoint);
+            return err;
+        };
+    }
+
+    entry.value_ptr.last_used = self._frame;
+}
+
+fn rasterize(self: *Self, codepoint: u32) !Glyph {
+    const atlas = if (self._atlas) |*value| value else return Error.NotLoaded;
+    const scale = self.v_metrics.scale;
+
+    const h_metrics = stb.truetype.getCodepointHMetrics(&self._info, codepoint);
+    var result: Glyph = .{
+        .advance_width = @as(f32, @floatFromInt(h_metrics.advance_width)) * scale,
+        .left_side_bearing = @as(f32, @floatFromInt(h_metrics.left_side_bearing)) * scale,
+        .index = stb.truetype.findGlyphIndex(&self._info, codepoint) catch 0,
+    };
+
+    const glyph_or_error = switch (self._type) {
+        .bitmap => stb.truetype.getCodepointBitmap(&self._info, scale, scale, codepoint),
+        .sdf => stb.truetype.getCodepointSDF(&self._info, self.size, codepoint, 4, 128, 32.0),
+    };
+
+    // Glyphs such as whitespace have no bitmap.
+    const glyph = glyph_or_error catch |err| switch (err) {
+        stb.truetype.Error.GlyphNotFound => return result,
+        else => return err,
+    };
+
+    const glyph_data = glyph.data orelse return result;
+    defer {
+        switch (self._type) {
+            .bitmap => stb.truetype.freeBitmap(glyph_data),
+            .sdf => stb.truetype.freeSDF(glyph_data),
+        }
+    }
+
+    if (glyph.w <= 0 or glyph.h <= 0) {
+        return result;
+    }
+
+    const region = try atlas.place(.init(@intCast(glyph.w), @intCast(glyph.h)), glyph_data);
+    result.setRegion(region);
+    result.offset = .init(@floatFromInt(glyph.xoff), @floatFromInt(glyph.yoff));
+    result.in_atlas = true;
+    return result;
+}
+
+/// Packs the most recently used glyphs into a new atlas at the base size. Glyphs that don't fit
+/// within 'keep_area' are removed and rasterized again when next used.
+fn compact(self: *Self, keep_area: usize) !void {
+    const old = &self._atlas.?;
+    const allocator = old._allocator;
+
+    const Entry = struct {
+        codepoint: u32,
+        last_used: u64,
+    };
+
+    var entries: std.ArrayList(Entry) = .empty;
+    defer entries.deinit(allocator);
+
+    var it = self.glyphs.iterator();
+    while (it.next()) |entry| {
+        if (entry.value_ptr.in_atlas) {
+            try entries.append(allocator, .{
+                .codepoint = entry.key_ptr.*,
+                .last_used = entry.value_ptr.last_used,
+            });
+        }
+    }
+
+    std.sort.pdq(Entry, entries.items, {}, struct {
+        fn lessThan(_: void, a: Entry, b: Entry) bool {
+            return a.last_used > b.last_used;
+        }
+    }.lessThan);
+
+    const regions = try allocator.alloc(Rectus, entries.items.len);
+    defer allocator.free(regions);
+
+    for (entries.items, regions) |entry, *region| {
+        region.* = self.glyphs.get(entry.codepoint).?.getRegion();
+    }
+
+    var atlas = try old.repack(regions, keep_area);
+    errdefer atlas.deinit();
+
+    const kept = atlas.regions.items.len;
+    for (entries.items[0..kept], atlas.regions.items) |entry, region| {
+        self.glyphs.getPtr(entry.codepoint).?.setRegion(region);
+    }
+
+    for (entries.items[kept..]) |entry| {
+        _ = self.glyphs.remove(entry.codepoint);
+    }
+
+    old.deinit();
+    self._atlas = atlas;
+}
+
+/// Iterates the codepoints of a UTF-8 string. Invalid sequences are returned as the replacement
+/// character.
+const CodepointIterator = struct {
+    bytes: []const u8,
+    index: usize = 0,
+
+    fn next(self: *CodepointIterator) ?u32 {
+        if (self.index >= self.bytes.len) {
+            return null;
+        }
+
+        const len = std.unicode.utf8ByteSequenceLength(self.bytes[self.index]) catch {
+            self.index += 1;
+            return replacement_character;
+        };
+
+        if (self.index + len > self.bytes.len) {
+            self.index = self.bytes.len;
+            return replacement_character;
+        }
+
+        const sequence = self.bytes[self.index..][0..len];
+        self.index += len;
+        return std.unicode.utf8Decode(sequence) catch replacement_character;
+    }
+};
+
+test "codepoint iterator" {
+    var it: CodepointIterator = .{ .bytes = "a\xc3\xa9\xe6\x97\xa5\xff" };
+    try std.testing.expectEqual('a', it.next());
+    try std.testing.expectEqual(0xE9, it.next());
+    try std.testing.expectEqual(0x65E5, it.next());
+    try std.testing.expectEqual(replacement_character, it.next());
+    try std.testing.expectEqual(null, it.next());
+}
+
+/// Loads the font shipped in the assets directory without a renderer.
+fn initTestFont(allocator: std.mem.Allocator, size: f32) !*Self {
+    const path = try std.fs.cwd().realpathAlloc(allocator, "assets/fonts/Roboto-Regular.ttf");
+    defer allocator.free(path);
+
+    const font: *Self = try .init(allocator, path);
+    errdefer {
+        font.deinit(allocator);
+        allocator.destroy(font);
+    }
+
+    try font.setup(allocator, size, .bitmap);
+    return font;
+}
+
+test "compact keeps the most recently used glyphs" {
+    const allocator = std.testing.allocator;
+
+    const font = try initTestFont(allocator, 32.0);
+    defer {
+        font.deinit(allocator);
+        allocator.destroy(font);
+    }
+
+    try font.cacheGlyphs("abc");
+    try font.beginFrame();
+    try font.cacheGlyphs("xyz");
+
+    var area: usize = 0;
+    for ("xyz") |ch| {
+        const region = font.glyphs.get(ch).?.getRegion();
+        area += (region.width() + 1) * (region.height() + 1);
+    }
+
+    const before = try font._atlas.?.buffer.getRegion(font.glyphs.get('x').?.getRegion());
+    defer allocator.free(before);
+
+    // Only the glyphs used in the latest frame fit in the area.
+    try font.compact(area);
+
+    for ("xyz") |ch| {
+        try std.testing.expect(font.glyphs.get(ch).?.in_atlas);
+    }
+    for ("abc") |ch| {
+        try std.testing.expect(!font.glyphs.contains(ch));
+    }
+
+    const after = try font._atlas.?.buffer.getRegion(font.glyphs.get('x').?.getRegion());
+    defer allocator.free(after);
+    try std.testing.expectEqualSlices(u8, before, after);
+    try std.testing.expectEqual(atlas_base_size, font._atlas.?.buffer.width);
+}
+
+test "flush uploads dirty regions" {
+    const allocator = std.testing.allocator;
+
+    const font = try initTestFont(allocator, 16.0);
+    defer {
+        font.deinit(allocator);
+        allocator.destroy(font);
+    }
+
+    // Without a texture of the atlas' size, all of it has to be uploaded.
+    try std.testing.expectEqual(.all, std.meta.activeTag(font.getPendingUpload().?));
+
+    font.texture.width = @intCast(atlas_base_size);
+    font.texture.height = @intCast(atlas_base_size);
+    try std.testing.expectEqual(0, font.getPendingUpload().?.regions.len);
+
+    // Only the regions of new glyphs are uploaded.
+    try font.cacheGlyphs("ab");
+    const regions = font.getPendingUpload().?.regions;
+    try std.testing.expectEqual(2, regions.len);
+    try std.testing.expectEqual(font.glyphs.get('a').?.getRegion(), regions[0]);
+    try std.testing.expectEqual(font.glyphs.get('b').?.getRegion(), regions[1]);
+
+    font._atlas.?.clearDirty();
+    try font.cacheGlyphs("ab");
+    try std.testing.expectEqual(0, font.getPendingUpload().?.regions.len);
 }
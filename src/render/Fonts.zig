@@ -1,18 +1,63 @@
+const core = @import("core");
 const io = @import("io");
 const render = @import("root.zig");
 const std = @import("std");
 
 const Font = render.Font;
 const Renderer = render.Renderer;
+const Vec2f = core.math.Vec2f;
 
 const Self = @This();
 
 pub const FontMap = std.StringHashMap(*Font);
 pub const FontHandleMap = std.AutoHashMap(Font.Handle, *Font);
 
+/// Identifies a measured string. The text is compared on lookup, so strings that hash the same
+/// can't return each other's size. Keys in the cache own a copy of the text.
+const MeasureKey = struct {
+    font: Font.Handle,
+    size: u32,
+    text: []const u8,
+
+    fn init(font: Font.Handle, size: f32, text: []const u8) MeasureKey {
+        return .{
+            .font = font,
+            .size = @bitCast(size),
+            .text = text,
+        };
+    }
+};
+
+const MeasureContext = struct {
+    pub fn hash(_: MeasureContext, key: MeasureKey) u64 {
+        var hasher = std.hash.Wyhash.init(0);
+        std.hash.autoHash(&hasher, key.font);
+        std.hash.autoHash(&hasher, key.size);
+        hasher.update(key.text);
+        return hasher.final();
+    }
+
+    pub fn eql(_: MeasureContext, a: MeasureKey, b: MeasureKey) bool {
+        return std.meta.eql(a.font, b.font) and a.size == b.size and
+            std.mem.eql(u8, a.text, b.text);
+    }
+};
+const MeasureMap = std.HashMap(
+    MeasureKey,
+    Vec2f,
+    MeasureContext,
+    std.hash_map.default_max_load_percentage,
+);
+
+/// The measurement cache is cleared once it holds this many entries.
+const max_measurements: usize = 4096;
+
 fonts: FontMap,
 default: Font.Handle = Font.Handle.invalid,
 _font_handles: FontHandleMap,
+_measurements: MeasureMap,
+/// Holds the text of the cached measurements. Reset along with the cache.
+_measure_text: std.heap.ArenaAllocator,
 
 /// Caller is responsible for returned memory.
 pub fn toKey(allocator: std.mem.Allocator, path: []const u8, size: f32) ![]u8 {
@@ -30,12 +75,16 @@ pub fn init(gpa: std.mem.Allocator) !*Self {
     result.* = .{
         .fonts = fonts,
         ._font_handles = font_handles,
+        ._measurements = .init(gpa),
+        ._measure_text = .init(gpa),
     };
     return result;
 }
 
 pub fn deinit(self: *Self, gpa: std.mem.Allocator) void {
     self._font_handles.deinit();
+    self._measurements.deinit();
+    self._measure_text.deinit();
 
     var it = self.fonts.iterator();
     while (it.next()) |font| {
@@ -81,3 +130,101 @@ pub fn loadFile(
 pub fn getByHandle(self: Self, handle: Font.Handle) ?*Font {
     return self._font_handles.get(handle);
 }
+
+/// Returns the size of the text drawn with the given font and size. Results are cached, so
+/// measuring text that hasn't changed is a single lookup.
+pub fn measure(self: *Self, handle: Font.Handle, size: f32, text: []const u8) !Vec2f {
+    const key: MeasureKey = .init(handle, size, text);
+    if (self._measurements.get(key)) |result| {
+        return result;
+    }
+
+    const font = self.getByHandle(handle) orelse return .zero;
+    font.scaleToSize(size);
+    const result = try font.measure(text);
+
+    if (self._measurements.count() >= max_measurements) {
+        self._measurements.clearRetainingCapacity();
+        _ = self._measure_text.reset(.retain_capacity);
+    }
+
+    const owned = try self._measure_text.allocator().dupe(u8, text);
+    try self._measurements.put(.init(handle, size, owned), result);
+
+    return result;
+}
+
+/// Must be called at the start of each frame before any text is measured or drawn.
+pub fn beginFrame(self: *Self) !void {
+    var it = self._font_handles.valueIterator();
+    while (it.next()) |font| {
+        try font.*.beginFrame();
+    }
+}
+
+test "measure key" {
+    const context: MeasureContext = .{};
+    const a: MeasureKey = .init(.init(1), 16.0, "Reset Camera");
+    const b: MeasureKey = .init(.init(1), 16.0, "Reset Camera");
+    const c: MeasureKey = .init(.init(1), 24.0, "Reset Camera");
+    const d: MeasureKey = .init(.init(2), 16.0, "Reset Camera");
+    const e: MeasureKey = .init(.init(1), 16.0, "Quit");
+
+    try std.testing.expect(context.eql(a, b));
+    try std.testing.expectEqual(context.hash(a), context.hash(b));
+    try std.testing.expect(!context.eql(a, c));
+    try std.testing.expect(!context.eql(a, d));
+    try std.testing.expect(!context.eql(a, e));
+}
+
+test "measure" {
+    const allocator = std.testing.allocator;
+
+    const fonts: *Self = try .init(allocator);
+    defer {
+        fonts.deinit(allocator);
+        allocator.destroy(fonts);
+    }
+
+    const path = try std.fs.cwd().realpathAlloc(allocator, "assets/fonts/Roboto-Regular.ttf");
+    defer allocator.free(path);
+
+    // The font is loaded without a renderer, so it is only added by its handle.
+    const font: *Font = try .init(allocator, path);
+    defer {
+        font.deinit(allocator);
+        allocator.destroy(font);
+    }
+    try font.setup(allocator, 16.0, .bitmap);
+    font.handle = .generate();
+    try fonts._font_handles.put(font.handle, font);
+
+    const size = try fonts.measure(font.handle, 16.0, "Reset Camera");
+    try std.testing.expect(size.x > 0.0 and size.y > 0.0);
+    try std.testing.expectEqual(1, fonts._measurements.count());
+
+    // Measuring the same text again is a hit, while a new size is a miss.
+    try std.testing.expectEqual(size, try fonts.measure(font.handle, 16.0, "Reset Camera"));
+    try std.testing.expectEqual(1, fonts._measurements.count());
+
+    const larger = try fonts.measure(font.handle, 32.0, "Reset Camera");
+    try std.testing.expect(larger.x > size.x);
+    try std.testing.expectEqual(2, fonts._measurements.count());
+
+    // The cache keeps its own copy of the text, so the caller's buffer may change.
+    var text = "Quit".*;
+    const quit = try fonts.measure(font.handle, 16.0, &text);
+    text[0] = 'q';
+    _ = try fonts.measure(font.handle, 16.0, &text);
+    try std.testing.expectEqual(quit, try fonts.measure(font.handle, 16.0, "Quit"));
+    try std.testing.expectEqual(4, fonts._measurements.count());
+
+    // A full cache is cleared before the next entry is added.
+    var buffer: [16]u8 = undefined;
+    var i: usize = 0;
+    while (fonts._measurements.count() < max_measurements) : (i += 1) {
+        _ = try fonts.measure(font.handle, 16.0, try std.fmt.bufPrint(&buffer, "{}", .{i}));
+    }
+    _ = try fonts.measure(font.handle, 16.0, "Evicted");
+    try std.testing.expectEqual(1, fonts._measurements.count());
+}
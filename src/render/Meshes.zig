@@ -3,6 +3,8 @@ const io = @import("io");
 const render = @import("root.zig");
 const std = @import("std");
 
+const Material = io.obj.Material;
+const mesh_cache = render.mesh_cache;
 const Model = io.obj.Model;
 const Phong = render.materials.Phong;
 const Program = render.shaders.Program;
@@ -26,6 +28,71 @@ pub const Mesh = struct {
     pub const Handle = core.Handle(Mesh);
 
     buffer: RenderBuffer = .{},
+    bounds: Bounds = .{},
+};
+
+/// A bounding sphere in the mesh's local space. Used for culling.
+pub const Bounds = struct {
+    center: Vec = .zero,
+    radius: f32 = 0.0,
+
+    pub fn fromVertices(vertices: []const Vertex) Bounds {
+        if (vertices.len == 0) {
+            return .{};
+        }
+
+        var min: Vec = .init3(vertices[0].x, vertices[0].y, vertices[0].z);
+        var max = min;
+        for (vertices[1..]) |vertex| {
+            const position: Vec = .init3(vertex.x, vertex.y, vertex.z);
+            min.data = @min(min.data, position.data);
+            max.data = @max(max.data, position.data);
+        }
+
+        const center = min.add(max).mul(0.5);
+        var radius_sq: f32 = 0.0;
+        for (vertices) |vertex| {
+            const offset = Vec.init3(vertex.x, vertex.y, vertex.z).sub(center);
+            radius_sq = @max(radius_sq, @reduce(.Add, offset.data * offset.data));
+        }
+
+        return .{
+            .center = center,
+            .radius = @sqrt(radius_sq),
+        };
+    }
+};
+
+/// A mesh loaded from a file along with the materials referenced by the file.
+pub const FileMesh = struct {
+    handle: Mesh.Handle,
+    materials: std.ArrayList(Material) = .empty,
+
+    pub fn deinit(self: *FileMesh, allocator: std.mem.Allocator) void {
+        for (self.materials.items) |*material| {
+            material.deinit(allocator);
+        }
+        self.materials.deinit(allocator);
+    }
+};
+
+/// A mesh read from a file that has not been uploaded yet.
+pub const FileData = struct {
+    buffer: VertexBuffer32,
+    materials: std.ArrayList(Material) = .empty,
+
+    pub fn deinit(self: *FileData, allocator: std.mem.Allocator) void {
+        self.buffer.deinit(allocator);
+        self.deinitMaterials(allocator);
+    }
+
+    /// Frees only the materials. Used once ownership of the buffer is given to an upload.
+    pub fn deinitMaterials(self: *FileData, allocator: std.mem.Allocator) void {
+        for (self.materials.items) |*material| {
+            material.deinit(allocator);
+        }
+        self.materials.deinit(allocator);
+    }
 };
 
 pub const MeshMap = std.AutoHashMapUnmanaged(Mesh.Handle, Mesh);
@@ -47,41 +114,145 @@ pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
 
 pub fn loadFromModel(self: *Self, renderer: *Renderer, model: Model) !Mesh.Handle {
     const vertex_buffer = try convert(renderer.allocator, model);
+    const bounds: Bounds = .fromVertices(vertex_buffer.vertices.items);
     var buffer = try renderer.uploadVertexBuffer(vertex_buffer);
     errdefer buffer.deinit();
 
     const handle: Mesh.Handle = .generate();
     try self._map.put(renderer.allocator, handle, .{
         .buffer = buffer,
+        .bounds = bounds,
     });
 
     return handle;
 }
 
-pub fn loadFromBuffer(self: *Self, renderer: *Renderer, buffer: anytype) !Mesh.Handle {
-    const render_buffer = try renderer.uploadVertexBuffer(buffer);
+/// Loads the mesh from an obj file. See 'readFile'.
+pub fn loadFromFile(
+    self: *Self,
+    renderer: *Renderer,
+    path: []const u8,
+    options: Model.Options,
+) !FileMesh {
+    const allocator = renderer.allocator;
+
+    var data = try readFile(allocator, path, options);
+    errdefer data.deinit(allocator);
 
+    // The upload owns the buffer once the mesh is loaded, and the materials are given to the
+    // caller.
+    const handle = try self.loadFromBuffer(renderer, data.buffer);
+    return .{
+        .handle = handle,
+        .materials = data.materials,
+    };
+}
+
+/// Reads the mesh and its materials from an obj file at an absolute path. The converted vertices
+/// are cached in the application data directory and reused until the file changes, which skips
+/// parsing and converting the model.
+/// Doesn't touch the GPU, so it may be called from any thread. The options are used if the model
+/// has to be parsed.
+pub fn readFile(
+    allocator: std.mem.Allocator,
+    path: []const u8,
+    options: Model.Options,
+) !FileData {
+    const dir = std.fs.cwd();
+
+    const source: mesh_cache.Source = try .fromFile(dir, path);
+    const cache_path = try mesh_cache.getPath(allocator, path);
+    defer allocator.free(cache_path);
+
+    const cached = mesh_cache.read(allocator, dir, cache_path, source) catch |err| blk: {
+        std.log.warn("Failed to read mesh cache '{s}'. Error: {}", .{ cache_path, err });
+        break :blk null;
+    };
+
+    if (cached) |entry| {
+        var entry_ = entry;
+        defer entry_.deinitPaths(allocator);
+
+        var result: FileData = .{
+            .buffer = entry_.buffer,
+        };
+        errdefer result.deinit(allocator);
+
+        try Model.loadMaterialLibraries(
+            allocator,
+            path,
+            entry_.material_paths.items,
+            &result.materials,
+        );
+        return result;
+    }
+
+    var model: Model = try .loadFileWith(allocator, path, options);
+    defer model.deinit(allocator);
+
+    const buffer = try convert(allocator, model);
+    mesh_cache.write(dir, cache_path, source, buffer, model.material_paths.items) catch |err| {
+        std.log.warn("Failed to write mesh cache '{s}'. Error: {}", .{ cache_path, err });
+    };
+
+    // The materials are moved out of the model.
+    const result: FileData = .{
+        .buffer = buffer,
+        .materials = model.materials,
+    };
+    model.materials = .empty;
+    return result;
+}
+
+pub fn loadFromBuffer(self: *Self, renderer: *Renderer, buffer: anytype) !Mesh.Handle {
     const handle: Mesh.Handle = .generate();
-    try self._map.put(renderer.allocator, handle, .{
+    try self.loadFromBufferWithHandle(renderer, handle, buffer);
+    return handle;
+}
+
+/// Same as 'loadFromBuffer', but uses a handle that was reserved for the mesh. The buffer is
+/// still owned by the caller if an error is returned.
+pub fn loadFromBufferWithHandle(
+    self: *Self,
+    renderer: *Renderer,
+    handle: Mesh.Handle,
+    buffer: anytype,
+) !void {
+    // The upload owns the buffer once it is made, so the map can't fail to grow afterwards.
+    try self._map.ensureUnusedCapacity(renderer.allocator, 1);
+
+    const bounds: Bounds = .fromVertices(buffer.vertices.items);
+    const render_buffer = try renderer.uploadVertexBuffer(buffer);
+    self._map.putAssumeCapacity(handle, .{
         .buffer = render_buffer,
+        .bounds = bounds,
     });
-
-    return handle;
 }
 
 pub fn get(self: Self, mesh: Mesh.Handle) ?Mesh {
     return self._map.get(mesh);
 }
 
-fn convert(allocator: std.mem.Allocator, model: Model) !VertexBuffer32 {
+/// Converts the faces of the model into an indexed triangle list. Elements that are shared
+/// between faces are only added once.
+pub fn convert(allocator: std.mem.Allocator, model: Model) !VertexBuffer32 {
     var buffer: VertexBuffer32 = try .init(allocator, 0, 0);
+    errdefer buffer.deinit(allocator);
+
+    // Every face with n elements produces n - 2 triangles.
+    const num_elements = model.elements.items.len;
+    const num_faces = model.numFaces();
+    const num_indices = if (num_elements > num_faces * 2) (num_elements - num_faces * 2) * 3 else 0;
+    try buffer.indices.ensureTotalCapacity(allocator, num_indices);
 
     var visited: VisitMap = .init(allocator);
     defer visited.deinit();
+    try visited.ensureTotalCapacity(@intCast(@min(num_elements, std.math.maxInt(u32))));
 
-    for (model.faces.items) |face| {
+    for (0..num_faces) |face_index| {
+        const face = model.getFace(face_index) orelse return Error.InvalidModel;
         var first_index: u32 = 0;
-        for (0..face.elements.items.len) |element_index| {
+        for (0..face.len()) |element_index| {
             const element = face.getTransformed(element_index) orelse return Error.InvalidModel;
             try addElement(allocator, &buffer, &visited, model, element);
 
@@ -6,8 +6,10 @@ const std = @import("std");
 const world = @import("world");
 const zbgfx = @import("zbgfx");
 
+const AssetLoader = render.AssetLoader;
 const Entity = world.Entity;
 const Fonts = render.Fonts;
+const Frustum = core.math.Frustum;
 const Mat = core.math.Mat;
 const MemFactory = render.MemFactory;
 const Meshes = render.Meshes;
@@ -15,7 +17,10 @@ const Model = io.obj.Model;
 const Program = render.shaders.Program;
 const Programs = render.shaders.Programs;
 const Query = world.Query;
+const render_queue = render.render_queue;
 const RenderBuffer = render.RenderBuffer;
+const RenderQueue = render.RenderQueue;
+const ResolvedTransform = world.components.core.ResolvedTransform;
 const SystemParam = world.Systems.SystemParam;
 const Texture = render.Texture;
 const Textures = render.Textures;
@@ -47,22 +52,33 @@ pub const ui_state = zbgfx.bgfx.StateFlags_WriteRgb |
         zbgfx.bgfx.StateFlags_BlendInvSrcAlpha,
     );
 
+/// Keeps the texture bindings between batches, as each batch binds the same samplers.
+const discard_keep_bindings: u8 = zbgfx.bgfx.DiscardFlags_All & ~zbgfx.bgfx.DiscardFlags_Bindings;
+
+const PhongQueue = RenderQueue(ecs.components.Phong);
+const ColorQueue = RenderQueue(ecs.components.Color);
+
 mem_factory: MemFactory,
 textures: Textures,
 programs: Programs,
 fonts: *Fonts,
 meshes: Meshes,
+assets: *AssetLoader,
 framebuffer_size: Vec2f = .zero,
 allocator: std.mem.Allocator,
 view_world: View,
 _uploads16: VertexBufferUploads16,
 _uploads32: VertexBufferUploads32,
+_phong_queue: PhongQueue = .{},
+_color_queue: ColorQueue = .{},
+_instancing: bool,
 
 pub fn init(allocator: std.mem.Allocator) !Self {
     var mem_factory = try MemFactory.init(allocator);
     const textures = try Textures.init(&mem_factory);
     var programs: Programs = .init();
     const fonts: *Fonts = try .init(allocator);
+    const assets: *AssetLoader = try .init(allocator);
 
     _ = try programs.buildWithName(
         allocator,
@@ -84,6 +100,26 @@ pub fn init(allocator: std.mem.Allocator) !Self {
         },
     );
 
+    _ = try programs.buildWithName(
+        allocator,
+        "common_instanced",
+        .{
+            .varying_file_name = "common/def.sc",
+            .fragment_file_name = "common/fragment.sc",
+            .vertex_file_name = "common/vertex_instanced.sc",
+        },
+    );
+
+    _ = try programs.buildWithName(
+        allocator,
+        "phong_instanced",
+        .{
+            .varying_file_name = "phong/def.sc",
+            .fragment_file_name = "phong/fragment.sc",
+            .vertex_file_name = "phong/vertex_instanced.sc",
+        },
+    );
+
     const view: View = .init(0x303030FF, true);
     // This needs to be a separate call. This notifies bgfx that this view will perform the
     // clear operation. Other views should not be performing any clears.
@@ -95,14 +131,20 @@ pub fn init(allocator: std.mem.Allocator) !Self {
         .programs = programs,
         .fonts = fonts,
         .meshes = .init(),
+        .assets = assets,
         .allocator = allocator,
         .view_world = view,
         ._uploads16 = try .init(allocator),
         ._uploads32 = try .init(allocator),
+        ._instancing = render_queue.isInstancingSupported(),
     };
 }
 
 pub fn deinit(self: *Self) void {
+    // Waits for any assets that are still decoding.
+    self.assets.deinit();
+    self.allocator.destroy(self.assets);
+
     self.meshes.deinit(self.allocator);
     self.fonts.deinit(self.allocator);
     self.allocator.destroy(self.fonts);
@@ -113,6 +155,9 @@ pub fn deinit(self: *Self) void {
 
     self._uploads16.deinit(self.allocator);
     self._uploads32.deinit(self.allocator);
+
+    self._phong_queue.deinit(self.allocator);
+    self._color_queue.deinit(self.allocator);
 }
 
 pub fn initECS(self: *Self, _world: *World) !void {
@@ -129,11 +174,24 @@ pub fn initECS(self: *Self, _world: *World) !void {
         ecs.components.Color,
     });
 
+    try _world.registerEvents(&.{
+        ecs.events.TextureLoaded,
+        ecs.events.MeshLoaded,
+    });
+
     _ = try _world.registerSystem(updateSystem, .update);
     // TODO: Need a way to render all meshes and their materials in a single system.
     _ = try _world.registerSystem(renderPhong, .render);
     _ = try _world.registerSystem(renderColor, .render);
     _ = try _world.registerSystem(shutdownSystem, .shutdown);
+    try _world.registerEventListener(onTextureLoaded);
+}
+
+/// Returns the draw counts from the last rendered frame.
+pub fn getStats(self: Self) render_queue.Stats {
+    var result = self._phong_queue.stats;
+    result.add(self._color_queue.stats);
+    return result;
 }
 
 pub fn updateView(self: *Self, size: Vec2u) void {
@@ -156,10 +214,21 @@ pub fn uploadVertexBuffer(self: *Self, buffer: anytype) !RenderBuffer {
     }
 }
 
+/// Returns true while the data of the given buffer is waiting to be uploaded to the GPU.
+pub fn isUploading(self: Self, buffer: RenderBuffer) bool {
+    return self._uploads16.isUploading(buffer) or self._uploads32.isUploading(buffer);
+}
+
 pub fn loadMeshFromModel(self: *Self, model: Model) !Meshes.Mesh.Handle {
     return self.meshes.loadFromModel(self, model);
 }
 
+/// Loads the mesh from an obj file using the mesh cache when it is up to date. The model is parsed
+/// on the asset loader's pool. The returned materials are owned by the caller.
+pub fn loadMeshFromFile(self: *Self, path: []const u8) !Meshes.FileMesh {
+    return self.meshes.loadFromFile(self, path, .{ .pool = self.assets.getPool() });
+}
+
 pub fn loadMeshFromBuffer(self: *Self, buffer: anytype) !Meshes.Mesh.Handle {
     return self.meshes.loadFromBuffer(self, buffer);
 }
@@ -187,21 +256,41 @@ fn updateSystem(param: SystemParam) !void {
     resource.renderer.mem_factory.update();
     resource.renderer._uploads16.update(resource.renderer.allocator);
     resource.renderer._uploads32.update(resource.renderer.allocator);
+    resource.renderer.assets.update(resource.renderer, param.world);
+}
+
+/// Replaces the placeholder textures of materials with the loaded texture.
+fn onTextureLoaded(
+    event: ecs.events.TextureLoaded,
+    materials: Query(&.{ecs.components.Phong}),
+    param: SystemParam,
+) !void {
+    var entities = materials.getEntities();
+    while (entities.next()) |entity| {
+        const phong = param.getComponent(ecs.components.Phong, entity.*) orelse continue;
+        if (phong.diffuse.handle.eql(event.texture.handle)) {
+            phong.diffuse = event.texture;
+        }
+
+        if (phong.specular.handle.eql(event.texture.handle)) {
+            phong.specular = event.texture;
+        }
+    }
 }
 
 fn renderPhong(
     meshes: Query(&.{
-        world.components.core.Transform,
+        world.Read(world.components.core.Transform),
         ecs.components.Mesh,
         ecs.components.Phong,
     }),
     point_lights: Query(&.{
-        world.components.core.Transform,
+        world.Read(world.components.core.Transform),
         ecs.components.Light,
         ecs.components.PointLight,
     }),
     directional_light: Query(&.{
-        world.components.core.Transform,
+        world.Read(world.components.core.Transform),
         ecs.components.DirectionalLight,
         ecs.components.Light,
     }),
@@ -212,6 +301,7 @@ fn renderPhong(
     const _render = param.world.getResource(ecs.resources.Render) orelse unreachable;
     const renderer = _render.renderer;
     const phong = renderer.programs.getByName("phong") orelse unreachable;
+    const phong_instanced = renderer.programs.getByName("phong_instanced") orelse unreachable;
 
     // Renders the empty scene. Will properly clear the background. If not here and no meshes are
     // found, then the framebuffer will just be a black screen.
@@ -221,7 +311,7 @@ fn renderPhong(
     {
         var entities = directional_light.getEntities();
         while (entities.next()) |entity| {
-            const transform = param.world.getComponent(Transform, entity.*) orelse continue;
+            const transform = param.world.readComponent(Transform, entity.*) orelse continue;
             const light = param.world.getComponent(ecs.components.Light, entity.*) orelse continue;
 
             try phong.setUniform("u_light_dir_direction", transform.rotation.toVec());
@@ -248,7 +338,7 @@ fn renderPhong(
 
         var entities = point_lights.getEntities();
         while (entities.next()) |entity| {
-            const transform = param.world.getComponent(Transform, entity.*) orelse continue;
+            const transform = param.world.readComponent(Transform, entity.*) orelse continue;
             const light = param.world.getComponent(ecs.components.Light, entity.*) orelse continue;
             const point_light = param.world.getComponent(ecs.components.PointLight, entity.*) orelse continue;
 
@@ -275,40 +365,60 @@ fn renderPhong(
         }
     }
 
-    // Render each mesh.
+    // Render each visible mesh, sorted so meshes sharing a material and mesh are drawn together.
     {
-        var entities = meshes.getEntities();
-        while (entities.next()) |entity| {
-            const mesh_component = param.world.getComponent(ecs.components.Mesh, entity.*) orelse continue;
-            const mesh = renderer.meshes.get(mesh_component.handle) orelse continue;
-            const material = param.world.getComponent(ecs.components.Phong, entity.*) orelse continue;
-
-            mesh.buffer.bind(world_state);
-            try phong.setUniform("u_diffuse", material.diffuse_color);
-            try phong.setTexture("s_diffuse", material.diffuse, 0);
-            try phong.setTexture("s_specular", material.specular, 1);
-            try phong.setUniform("u_specular_shininess", Vec.init(
-                material.specular_color.x(),
-                material.specular_color.y(),
-                material.specular_color.z(),
-                material.shininess,
-            ));
-
-            const model_mat = getTransform(entity.*, param);
-            const normal_mat = model_mat.inverse().transpose();
-
-            _ = zbgfx.bgfx.setTransform(&model_mat.toArray(), 1);
-            try phong.setUniform("u_normal_mat", normal_mat);
-
-            zbgfx.bgfx.submit(renderer.view_world.id, phong.bgfx_handle, 0, 0);
-            zbgfx.bgfx.discard(zbgfx.bgfx.DiscardFlags_All);
+        const queue = &renderer._phong_queue;
+        try renderer.collect(ecs.components.Phong, queue, meshes, param);
+
+        // Material uniforms and textures are only set when the material changes.
+        const program = if (renderer._instancing) phong_instanced else phong;
+
+        var current: ?*const ecs.components.Phong = null;
+        var batches = queue.batches();
+        while (batches.next()) |batch| {
+            const mesh = renderer.meshes.get(batch.mesh) orelse continue;
+
+            const material = batch.material;
+            if (current == null or !current.?.eql(material.*)) {
+                try program.setUniform("u_diffuse", material.diffuse_color);
+                try program.setTexture("s_diffuse", material.diffuse, 0);
+                try program.setTexture("s_specular", material.specular, 1);
+                try program.setUniform("u_specular_shininess", Vec.init(
+                    material.specular_color.x(),
+                    material.specular_color.y(),
+                    material.specular_color.z(),
+                    material.shininess,
+                ));
+                current = material;
+            }
+
+            if (renderer._instancing) {
+                renderer.submitInstanced(mesh, batch.items, phong_instanced, &queue.stats);
+                continue;
+            }
+
+            for (batch.items) |item| {
+                mesh.buffer.bind(world_state);
+                _ = zbgfx.bgfx.setTransform(&item.transform.toArray(), 1);
+                try phong.setUniform("u_normal_mat", item.normal);
+                zbgfx.bgfx.submit(
+                    renderer.view_world.id,
+                    phong.bgfx_handle,
+                    0,
+                    discard_keep_bindings,
+                );
+                queue.stats.draw_calls += 1;
+                queue.stats.instances += 1;
+            }
         }
+
+        zbgfx.bgfx.discard(zbgfx.bgfx.DiscardFlags_All);
     }
 }
 
 fn renderColor(
     meshes: Query(&.{
-        world.components.core.Transform,
+        world.Read(world.components.core.Transform),
         ecs.components.Mesh,
         ecs.components.Color,
     }),
@@ -317,33 +427,120 @@ fn renderColor(
     const _render = param.world.getResource(ecs.resources.Render) orelse unreachable;
     const renderer = _render.renderer;
     const common = renderer.programs.getByName("common") orelse unreachable;
+    const common_instanced = renderer.programs.getByName("common_instanced") orelse unreachable;
     const sampler = try common.getUniform("s_tex_color");
 
+    const queue = &renderer._color_queue;
+    try renderer.collect(ecs.components.Color, queue, meshes, param);
+
     try renderer.textures.default.bind(sampler.handle, 0);
 
-    var entities = meshes.getEntities();
-    while (entities.next()) |entity| {
-        const mesh_component = param.world.getComponent(ecs.components.Mesh, entity.*) orelse continue;
-        const mesh = renderer.meshes.get(mesh_component.handle) orelse continue;
-        const material = param.world.getComponent(ecs.components.Color, entity.*) orelse continue;
+    // The tint is applied per instance when instancing.
+    if (renderer._instancing) {
+        try common_instanced.setUniform("u_color", Vec.splat(1.0));
+    }
 
-        const mat = getTransform(entity.*, param);
-        mesh.buffer.bind(world_state);
-        _ = zbgfx.bgfx.setTransform(&mat.toArray(), 1);
-        try common.setUniform("u_color", material.tint);
-        zbgfx.bgfx.submit(renderer.view_world.id, common.bgfx_handle, 0, 0);
-        zbgfx.bgfx.discard(zbgfx.bgfx.DiscardFlags_All);
+    var batches = queue.batches();
+    while (batches.next()) |batch| {
+        const mesh = renderer.meshes.get(batch.mesh) orelse continue;
+
+        if (renderer._instancing) {
+            renderer.submitInstanced(mesh, batch.items, common_instanced, &queue.stats);
+            continue;
+        }
+
+        for (batch.items) |item| {
+            mesh.buffer.bind(world_state);
+            _ = zbgfx.bgfx.setTransform(&item.transform.toArray(), 1);
+            try common.setUniform("u_color", item.tint);
+            zbgfx.bgfx.submit(renderer.view_world.id, common.bgfx_handle, 0, discard_keep_bindings);
+            queue.stats.draw_calls += 1;
+            queue.stats.instances += 1;
+        }
     }
+
+    zbgfx.bgfx.discard(zbgfx.bgfx.DiscardFlags_All);
 }
 
-fn getTransform(entity: Entity, param: SystemParam) Mat {
-    if (param.getComponent(world.components.core.ResolvedTransform, entity)) |transform| {
-        return transform.transform;
+/// Fills the queue with every mesh in the query that is within the camera's frustum, sorted by
+/// material and mesh.
+fn collect(
+    self: *Self,
+    comptime Material: type,
+    queue: *RenderQueue(Material),
+    meshes: anytype,
+    param: SystemParam,
+) !void {
+    queue.clear();
+
+    const frustum: Frustum = .init(self.view_world.getViewProjection());
+
+    var it = meshes.iter(param.world);
+    while (it.next()) |item| {
+        const handle = item.get(ecs.components.Mesh).handle;
+        const mesh = self.meshes.get(handle) orelse continue;
+        const resolved = getTransform(item.entity, item.get(Transform), param);
+
+        const center = resolved.transform.transformPoint(mesh.bounds.center);
+        const radius = mesh.bounds.radius * resolved.transform.getMaxScale();
+        if (!frustum.containsSphere(center, radius)) {
+            queue.stats.culled += 1;
+            continue;
+        }
+
+        const material = item.get(Material);
+        const tint = if (Material == ecs.components.Color) material.tint else Vec.splat(1.0);
+        try queue.push(
+            self.allocator,
+            handle,
+            material.*,
+            resolved.transform,
+            resolved.normal,
+            tint,
+        );
     }
 
-    if (param.getComponent(world.components.core.Transform, entity)) |transform| {
-        return transform.toMatrix();
+    queue.sort();
+}
+
+/// Draws all items of a batch with instance data buffers. Large batches are split into several
+/// submits if bgfx can't provide enough instance data for the entire batch.
+fn submitInstanced(
+    self: Self,
+    mesh: Meshes.Mesh,
+    items: anytype,
+    program: *const Program,
+    stats: *render_queue.Stats,
+) void {
+    var remaining = items;
+    while (remaining.len > 0) {
+        var buffer: zbgfx.bgfx.InstanceDataBuffer = undefined;
+        const count = render_queue.allocInstances(&buffer, remaining);
+        if (count == 0) {
+            std.log.warn("Out of instance data. Skipping {} instances.", .{remaining.len});
+            return;
+        }
+
+        mesh.buffer.bind(world_state);
+        zbgfx.bgfx.setInstanceDataBuffer(&buffer, 0, count);
+        zbgfx.bgfx.submit(self.view_world.id, program.bgfx_handle, 0, discard_keep_bindings);
+
+        stats.draw_calls += 1;
+        stats.instances += count;
+        remaining = remaining[count..];
+    }
+}
+
+/// Returns the matrices resolved by the transform hierarchy. Entities created this frame haven't
+/// been resolved yet and fall back to their local transform.
+fn getTransform(
+    entity: Entity,
+    transform: *const Transform,
+    param: SystemParam,
+) ResolvedTransform {
+    if (param.getComponent(ResolvedTransform, entity)) |resolved| {
+        return resolved.*;
     }
 
-    return .identity;
+    return .init(transform.toMatrix());
 }
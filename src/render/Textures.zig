@@ -1,3 +1,4 @@
+const core = @import("core");
 const io = @import("io");
 const MemFactory = @import("MemFactory.zig");
 const stb = @import("stb");
@@ -5,6 +6,8 @@ const std = @import("std");
 const Texture = @import("Texture.zig");
 const zbgfx = @import("zbgfx");
 
+const Rectus = core.math.Rectus;
+
 const Self = @This();
 
 pub const Error = error{
@@ -61,14 +64,25 @@ pub fn loadImageAbsolute(self: *Self, mem_factory: *MemFactory, path: []const u8
     defer allocator.free(contents);
 
     const data = try stb.image.load_from_memory(contents);
+    return self.loadDecodedImage(mem_factory, .generate(), data);
+}
 
+/// Uploads an image that was already decoded, e.g. on a worker thread, under a handle that was
+/// reserved for it. The texture takes ownership of the image data, unless an error is returned.
+pub fn loadDecodedImage(
+    self: *Self,
+    mem_factory: *MemFactory,
+    handle: Texture.Handle,
+    image: stb.image.Image,
+) !Texture {
     return self.load(
         mem_factory,
+        handle,
         .stb_image,
-        data.data,
-        data.size(),
-        data.width,
-        data.height,
+        image.data,
+        image.size(),
+        image.width,
+        image.height,
         Texture.Format.rgba8,
     );
 }
@@ -80,9 +94,24 @@ pub fn loadBuffer(
     width: u16,
     height: u16,
     format: Texture.Format,
+) !Texture {
+    return self.loadBufferWithHandle(mem_factory, .generate(), buffer, width, height, format);
+}
+
+/// Same as 'loadBuffer', but uses a handle that was reserved for the texture. The buffer is still
+/// owned by the caller if an error is returned.
+pub fn loadBufferWithHandle(
+    self: *Self,
+    mem_factory: *MemFactory,
+    handle: Texture.Handle,
+    buffer: []const u8,
+    width: u16,
+    height: u16,
+    format: Texture.Format,
 ) !Texture {
     return self.load(
         mem_factory,
+        handle,
         .buffer,
         buffer.ptr,
         buffer.len,
@@ -102,6 +131,7 @@ pub fn loadStaticBuffer(
 ) !Texture {
     return self.load(
         mem_factory,
+        .generate(),
         .static_buffer,
         buffer.ptr,
         buffer.len,
@@ -111,6 +141,93 @@ pub fn loadStaticBuffer(
     );
 }
 
+/// Creates a texture whose contents are set with 'update'. The contents are undefined until
+/// then.
+pub fn createDynamic(
+    self: *Self,
+    allocator: std.mem.Allocator,
+    width: u16,
+    height: u16,
+    format: Texture.Format,
+) !Texture {
+    const bgfx_handle = zbgfx.bgfx.createTexture2D(
+        width,
+        height,
+        false,
+        1,
+        toBgfxFormat(format),
+        zbgfx.bgfx.TextureFlags_None,
+        null,
+    );
+
+    const result = Texture{
+        .handle = .generate(),
+        .bgfx_handle = bgfx_handle,
+        .width = width,
+        .height = height,
+        .format = format,
+    };
+
+    try self.collection.append(allocator, result);
+    return result;
+}
+
+/// Uploads a region of 'data' to the same region of a dynamic texture. 'data' is an image with
+/// the given width in pixels and the same format as the texture. Only the rows of the region are
+/// copied, so small updates stay cheap.
+pub fn update(texture: Texture, region: Rectus, data: []const u8, data_width: usize) void {
+    const handle = texture.bgfx_handle orelse return;
+    const bytes_per_pixel: usize = switch (texture.format) {
+        .grayscale => 1,
+        .rgba8 => 4,
+    };
+
+    const width = region.width() + 1;
+    const height = region.height() + 1;
+    const row_size = width * bytes_per_pixel;
+
+    const mem = zbgfx.bgfx.alloc(@intCast(row_size * height));
+    const dst = mem.*.data[0 .. row_size * height];
+    for (0..height) |row| {
+        const src = ((region.min.y + row) * data_width + region.min.x) * bytes_per_pixel;
+        @memcpy(dst[row * row_size ..][0..row_size], data[src..][0..row_size]);
+    }
+
+    zbgfx.bgfx.updateTexture2D(
+        handle,
+        0,
+        0,
+        @intCast(region.min.x),
+        @intCast(region.min.y),
+        @intCast(width),
+        @intCast(height),
+        mem,
+        @intCast(row_size),
+    );
+}
+
+/// Destroys the texture and removes it from the collection.
+pub fn destroy(self: *Self, handle: Texture.Handle) void {
+    for (self.collection.items, 0..) |*item, i| {
+        if (item.handle.eql(handle)) {
+            item.deinit();
+            _ = self.collection.swapRemove(i);
+            return;
+        }
+    }
+}
+
+/// Returns true while the texture's data is waiting to be uploaded to the GPU.
+pub fn isUploading(self: Self, handle: Texture.Handle) bool {
+    for (self._uploads.items) |upload| {
+        if (upload.handle.eql(handle)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 pub fn getByHandle(self: Self, handle: Texture.Handle) ?Texture {
     for (self.collection.items) |item| {
         if (item.handle.eql(handle)) {
@@ -124,6 +241,7 @@ pub fn getByHandle(self: Self, handle: Texture.Handle) ?Texture {
 fn load(
     self: *Self,
     mem_factory: *MemFactory,
+    handle: Texture.Handle,
     buffer_type: BufferType,
     buffer: [*]const u8,
     length: usize,
@@ -131,18 +249,22 @@ fn load(
     height: u16,
     format: Texture.Format,
 ) !Texture {
-    const handle: Texture.Handle = .generate();
     const slice = buffer[0..length];
 
+    // bgfx owns the buffer once its memory is created, so everything that can fail is done first.
+    try self.collection.ensureUnusedCapacity(mem_factory.allocator, 1);
+
     const mem = blk: {
         switch (buffer_type) {
             .stb_image, .buffer => {
                 const upload = try mem_factory.allocator.create(Upload);
+                errdefer mem_factory.allocator.destroy(upload);
                 upload.handle = handle;
                 upload.textures = self;
                 upload.buffer_type = buffer_type;
 
                 try self._uploads.append(mem_factory.allocator, upload);
+                errdefer _ = self._uploads.pop();
                 break :blk try mem_factory.create(
                     slice,
                     onUploadedCallback,
@@ -155,17 +277,12 @@ fn load(
         }
     };
 
-    const fmt: zbgfx.bgfx.TextureFormat = switch (format) {
-        .grayscale => .R8,
-        .rgba8 => .RGBA8,
-    };
-
     const bgfx_handle = zbgfx.bgfx.createTexture2D(
         width,
         height,
         false,
         1,
-        fmt,
+        toBgfxFormat(format),
         zbgfx.bgfx.TextureFlags_None,
         mem.ptr,
     );
@@ -178,10 +295,17 @@ fn load(
         .format = format,
     };
 
-    try self.collection.append(mem_factory.allocator, result);
+    self.collection.appendAssumeCapacity(result);
     return result;
 }
 
+fn toBgfxFormat(format: Texture.Format) zbgfx.bgfx.TextureFormat {
+    return switch (format) {
+        .grayscale => .R8,
+        .rgba8 => .RGBA8,
+    };
+}
+
 /// Called on the main thread. No need to worry about a mutex.
 fn onUploaded(self: *Self, allocator: std.mem.Allocator, handle: Texture.Handle) void {
     for (self._uploads.items, 0..) |upload, i| {
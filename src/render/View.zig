@@ -12,6 +12,8 @@ id: zbgfx.bgfx.ViewId,
 clear_color: u32,
 clear_depth: bool,
 projection: Mat,
+/// The view matrix from the last submit.
+view: Mat = .identity,
 
 pub fn init(clear_color: u32, clear_depth: bool) Self {
     const id = view_count;
@@ -55,15 +57,20 @@ pub fn setMode(self: Self, mode: zbgfx.bgfx.ViewMode) void {
     zbgfx.bgfx.setViewMode(self.id, mode);
 }
 
-pub fn submitPerspective(self: Self, perspective: Mat, width: u16, height: u16) void {
+pub fn submitPerspective(self: *Self, perspective: Mat, width: u16, height: u16) void {
     self.submit(perspective, width, height);
 }
 
-pub fn submitOrthographic(self: Self, width: u16, height: u16) void {
+pub fn submitOrthographic(self: *Self, width: u16, height: u16) void {
     self.submit(.identity, width, height);
 }
 
-fn submit(self: Self, view_matrix: Mat, width: u16, height: u16) void {
+pub fn getViewProjection(self: Self) Mat {
+    return self.view.mul(self.projection);
+}
+
+fn submit(self: *Self, view_matrix: Mat, width: u16, height: u16) void {
+    self.view = view_matrix;
     zbgfx.bgfx.setViewTransform(
         self.id,
         &view_matrix.toArray(),
@@ -1,5 +1,6 @@
 const core = @import("core");
 const render = @import("../root.zig");
+const std = @import("std");
 
 const materials = render.materials;
 const Meshes = render.Meshes;
@@ -17,6 +18,26 @@ pub const Phong = struct {
     specular: Texture = .{},
     specular_color: Vec = .zero,
     shininess: f32 = 32.0,
+
+    /// Groups meshes that share a material when sorting the render queue. Every field compared by
+    /// 'eql' is hashed, so materials that only differ by color aren't interleaved.
+    pub fn sortKey(self: Phong) u32 {
+        var hasher: std.hash.Wyhash = .init(0);
+        std.hash.autoHash(&hasher, self.diffuse.handle.id);
+        std.hash.autoHash(&hasher, self.specular.handle.id);
+        hasher.update(std.mem.asBytes(&self.diffuse_color.data));
+        hasher.update(std.mem.asBytes(&self.specular_color.data));
+        hasher.update(std.mem.asBytes(&self.shininess));
+        return @truncate(hasher.final());
+    }
+
+    pub fn eql(self: Phong, other: Phong) bool {
+        return self.diffuse.handle.eql(other.diffuse.handle) and
+            self.specular.handle.eql(other.specular.handle) and
+            std.meta.eql(self.diffuse_color.data, other.diffuse_color.data) and
+            std.meta.eql(self.specular_color.data, other.specular_color.data) and
+            self.shininess == other.shininess;
+    }
 };
 
 pub const Light = struct {
@@ -27,6 +48,15 @@ pub const Light = struct {
 
 pub const Color = struct {
     tint: Vec = .splat(1.0),
+
+    /// The tint is submitted per instance, so all colored meshes share the same material.
+    pub fn sortKey(_: Color) u32 {
+        return 0;
+    }
+
+    pub fn eql(_: Color, _: Color) bool {
+        return true;
+    }
 };
 
 pub const DirectionalLight = struct {};
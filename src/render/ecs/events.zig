@@ -0,0 +1,20 @@
+const io = @import("io");
+const render = @import("../root.zig");
+
+const Material = io.obj.Material;
+const Meshes = render.Meshes;
+const Texture = render.Texture;
+
+/// Triggered once a texture requested from the asset loader has been uploaded to the GPU.
+/// 'texture' replaces the placeholder that was returned with the same handle.
+pub const TextureLoaded = struct {
+    texture: Texture = .{},
+};
+
+/// Triggered once a mesh requested from the asset loader has been uploaded to the GPU. The
+/// materials are owned by the loader and can also be retrieved with 'getMaterials'.
+pub const MeshLoaded = struct {
+    handle: Meshes.Mesh.Handle = .invalid,
+    path: []const u8 = "",
+    materials: []const Material = &.{},
+};
@@ -1,2 +1,3 @@
 pub const components = @import("components.zig");
+pub const events = @import("events.zig");
 pub const resources = @import("resources.zig");
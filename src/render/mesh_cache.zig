@@ -0,0 +1,294 @@
+const render = @import("root.zig");
+const std = @import("std");
+
+const Vertex = render.Vertex;
+const VertexBuffer32 = render.VertexBuffer32;
+
+/// The extension of cache files.
+pub const extension = ".cache";
+
+/// The directory within the application data directory that holds the caches.
+const directory = "LevelSketch" ++ std.fs.path.sep_str ++ "mesh_cache";
+
+const magic: [4]u8 = .{ 'L', 'S', 'M', 'C' };
+const version: u32 = 2;
+
+/// Identifies the file the cache was built from and its contents. The cache is rebuilt when any
+/// value changes.
+pub const Source = struct {
+    /// Caches are named after a hash of the path, so the path is stored to rule out collisions.
+    path: []const u8,
+    size: u64,
+    mtime: i128,
+
+    /// The path is referenced, not copied.
+    pub fn fromFile(dir: std.fs.Dir, path: []const u8) !Source {
+        const stat = try dir.statFile(path);
+        return .{
+            .path = path,
+            .size = stat.size,
+            .mtime = stat.mtime,
+        };
+    }
+};
+
+/// The cache is stored in native byte order, starting with this header. The header is followed
+/// by the source path, the length and bytes of each material library path, then the vertices and
+/// indices.
+const Header = extern struct {
+    magic: [4]u8 = magic,
+    version: u32 = version,
+    vertex_size: u32 = @sizeOf(Vertex),
+    num_material_paths: u32 = 0,
+    num_vertices: u64 = 0,
+    num_indices: u64 = 0,
+    source_size: u64 = 0,
+    source_mtime: [2]u64 = .{ 0, 0 },
+    source_path_len: u64 = 0,
+
+    fn init(source: Source) Header {
+        const mtime: u128 = @bitCast(source.mtime);
+        return .{
+            .source_size = source.size,
+            .source_mtime = .{ @truncate(mtime), @truncate(mtime >> 64) },
+            .source_path_len = source.path.len,
+        };
+    }
+
+    fn matches(self: Header, source: Source) bool {
+        const expected: Header = .init(source);
+        return std.mem.eql(u8, &self.magic, &magic) and
+            self.version == version and
+            self.vertex_size == @sizeOf(Vertex) and
+            self.source_size == expected.source_size and
+            std.mem.eql(u64, &self.source_mtime, &expected.source_mtime) and
+            self.source_path_len == expected.source_path_len;
+    }
+};
+
+/// A mesh read from the cache. 'buffer' is ready to be uploaded.
+pub const Entry = struct {
+    buffer: VertexBuffer32,
+    material_paths: std.ArrayList([]const u8),
+
+    pub fn deinit(self: *Entry, allocator: std.mem.Allocator) void {
+        self.buffer.deinit(allocator);
+        self.deinitPaths(allocator);
+    }
+
+    /// Frees only the material paths. Used once ownership of the buffer is given to an upload.
+    pub fn deinitPaths(self: *Entry, allocator: std.mem.Allocator) void {
+        for (self.material_paths.items) |path| {
+            allocator.free(path);
+        }
+        self.material_paths.deinit(allocator);
+    }
+};
+
+/// Returns the path of the cache for the given absolute model path. Caches are kept in the
+/// application data directory and named after a hash of the model path. Falls back to a file next
+/// to the model if there is no data directory. Caller owns the memory.
+pub fn getPath(allocator: std.mem.Allocator, model_path: []const u8) ![]u8 {
+    const data_dir = std.fs.getAppDataDir(allocator, directory) catch |err| {
+        std.log.warn("Failed to find the application data directory. Error: {}", .{err});
+        return std.mem.concat(allocator, u8, &.{ model_path, extension });
+    };
+    defer allocator.free(data_dir);
+
+    const hash = std.hash.Wyhash.hash(0, model_path);
+    var name: [16 + extension.len]u8 = undefined;
+    _ = std.fmt.bufPrint(&name, "{x:0>16}" ++ extension, .{hash}) catch unreachable;
+    return std.fs.path.join(allocator, &.{ data_dir, &name });
+}
+
+/// Writes the cache to a temporary file that is renamed over 'path' once it is complete, so
+/// readers never see a partially written cache. Missing directories are created.
+pub fn write(
+    dir: std.fs.Dir,
+    path: []const u8,
+    source: Source,
+    buffer: VertexBuffer32,
+    material_paths: []const []const u8,
+) !void {
+    var write_buffer: [64 * 1024]u8 = undefined;
+    var file = try dir.atomicFile(path, .{
+        .make_path = true,
+        .write_buffer = &write_buffer,
+    });
+    defer file.deinit();
+
+    const writer = &file.file_writer.interface;
+
+    var header: Header = .init(source);
+    header.num_material_paths = @intCast(material_paths.len);
+    header.num_vertices = buffer.vertices.items.len;
+    header.num_indices = buffer.indices.items.len;
+    try writer.writeAll(std.mem.asBytes(&header));
+    try writer.writeAll(source.path);
+
+    for (material_paths) |material_path| {
+        const len: u32 = @intCast(material_path.len);
+        try writer.writeAll(std.mem.asBytes(&len));
+        try writer.writeAll(material_path);
+    }
+
+    try writer.writeAll(std.mem.sliceAsBytes(buffer.vertices.items));
+    try writer.writeAll(std.mem.sliceAsBytes(buffer.indices.items));
+
+    try file.finish();
+}
+
+/// Reads the cache at the given path. Returns null if there is no cache, it was not built from
+/// the given source, or its size doesn't match its header.
+pub fn read(
+    allocator: std.mem.Allocator,
+    dir: std.fs.Dir,
+    path: []const u8,
+    source: Source,
+) !?Entry {
+    const file = dir.openFile(path, .{}) catch |err| switch (err) {
+        error.FileNotFound => return null,
+        else => return err,
+    };
+    defer file.close();
+
+    var header: Header = undefined;
+    if (try file.readAll(std.mem.asBytes(&header)) != @sizeOf(Header) or !header.matches(source)) {
+        return null;
+    }
+
+    // The counts in the header size the allocations below, so a truncated or corrupt file must be
+    // caught before they are trusted. Every section is checked against the bytes left in the file.
+    const file_size = (try file.stat()).size;
+    var remaining = std.math.sub(u64, file_size, @sizeOf(Header)) catch return null;
+    if (!consume(&remaining, source.path.len) or
+        !consume(&remaining, @as(u64, header.num_material_paths) * @sizeOf(u32)))
+    {
+        return null;
+    }
+
+    // A different model whose path hashes to the same name.
+    const source_path = try allocator.alloc(u8, source.path.len);
+    defer allocator.free(source_path);
+    try readExact(file, source_path);
+    if (!std.mem.eql(u8, source_path, source.path)) {
+        return null;
+    }
+
+    var result: Entry = .{
+        .buffer = try .init(allocator, 0, 0),
+        .material_paths = .empty,
+    };
+    errdefer result.deinit(allocator);
+
+    try result.material_paths.ensureTotalCapacityPrecise(allocator, header.num_material_paths);
+    for (0..header.num_material_paths) |_| {
+        var len: u32 = 0;
+        try readExact(file, std.mem.asBytes(&len));
+        if (!consume(&remaining, len)) {
+            return null;
+        }
+
+        const material_path = try allocator.alloc(u8, len);
+        errdefer allocator.free(material_path);
+        try readExact(file, material_path);
+
+        result.material_paths.appendAssumeCapacity(material_path);
+    }
+
+    const vertices_size = std.math.mul(u64, header.num_vertices, @sizeOf(Vertex)) catch return null;
+    const indices_size = std.math.mul(u64, header.num_indices, @sizeOf(u32)) catch return null;
+    if (!consume(&remaining, vertices_size) or !consume(&remaining, indices_size) or
+        remaining != 0)
+    {
+        return null;
+    }
+
+    // Read directly into the buffers that will be uploaded.
+    try result.buffer.vertices.resize(allocator, @intCast(header.num_vertices));
+    try readExact(file, std.mem.sliceAsBytes(result.buffer.vertices.items));
+
+    try result.buffer.indices.resize(allocator, @intCast(header.num_indices));
+    try readExact(file, std.mem.sliceAsBytes(result.buffer.indices.items));
+
+    return result;
+}
+
+/// Takes 'len' bytes from what is left of the file. Returns false if there aren't enough.
+fn consume(remaining: *u64, len: u64) bool {
+    if (len > remaining.*) {
+        return false;
+    }
+
+    remaining.* -= len;
+    return true;
+}
+
+fn readExact(file: std.fs.File, buffer: []u8) !void {
+    if (try file.readAll(buffer) != buffer.len) {
+        return error.EndOfStream;
+    }
+}
+
+test "mesh cache round trip" {
+    const allocator = std.testing.allocator;
+
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+
+    var buffer: VertexBuffer32 = try .init(allocator, 3, 3);
+    defer buffer.deinit(allocator);
+
+    for (buffer.vertices.items, buffer.indices.items, 0..) |*vertex, *index, i| {
+        vertex.x = @floatFromInt(i);
+        vertex.u = 0.5;
+        index.* = @intCast(i);
+    }
+
+    const path = "cache" ++ std.fs.path.sep_str ++ "model" ++ extension;
+    const source: Source = .{
+        .path = "/models/model.obj",
+        .size = 1024,
+        .mtime = 123_456_789,
+    };
+    try write(tmp.dir, path, source, buffer, &.{ "a.mtl", "b.mtl" });
+
+    var entry = try read(allocator, tmp.dir, path, source) orelse
+        return error.TestUnexpectedResult;
+    defer entry.deinit(allocator);
+
+    try std.testing.expectEqualSlices(Vertex, buffer.vertices.items, entry.buffer.vertices.items);
+    try std.testing.expectEqualSlices(u32, buffer.indices.items, entry.buffer.indices.items);
+    try std.testing.expectEqual(2, entry.material_paths.items.len);
+    try std.testing.expectEqualStrings("a.mtl", entry.material_paths.items[0]);
+    try std.testing.expectEqualStrings("b.mtl", entry.material_paths.items[1]);
+
+    // A modified source invalidates the cache.
+    const modified: Source = .{
+        .path = source.path,
+        .size = 1024,
+        .mtime = 987_654_321,
+    };
+    try std.testing.expectEqual(null, try read(allocator, tmp.dir, path, modified));
+
+    // So does a different model with the same size and modification time.
+    var other = source;
+    other.path = "/models/other.obj";
+    try std.testing.expectEqual(null, try read(allocator, tmp.dir, path, other));
+
+    // A truncated cache is a miss rather than an error.
+    {
+        const file = try tmp.dir.openFile(path, .{ .mode = .read_write });
+        defer file.close();
+        try file.setEndPos((try file.getEndPos()) - 1);
+    }
+    try std.testing.expectEqual(null, try read(allocator, tmp.dir, path, source));
+
+    // No temporary files are left behind.
+    var cache_dir = try tmp.dir.openDir("cache", .{ .iterate = true });
+    defer cache_dir.close();
+
+    var it = cache_dir.iterate();
+    try std.testing.expectEqualStrings("model" ++ extension, (try it.next()).?.name);
+    try std.testing.expectEqual(null, try it.next());
+}
@@ -0,0 +1,230 @@
+const core = @import("core");
+const render = @import("root.zig");
+const std = @import("std");
+const zbgfx = @import("zbgfx");
+
+const Mat = core.math.Mat;
+const Meshes = render.Meshes;
+const Vec = core.math.Vec;
+
+/// The per-instance data uploaded to the instance data buffer. The model matrix occupies
+/// 'i_data0' through 'i_data3' and the tint 'i_data4'.
+pub const InstanceData = extern struct {
+    model: [16]f32,
+    tint: [4]f32,
+};
+
+pub const instance_stride: u16 = @sizeOf(InstanceData);
+
+/// Counters for the draws submitted during a frame.
+pub const Stats = struct {
+    draw_calls: u32 = 0,
+    instances: u32 = 0,
+    culled: u32 = 0,
+
+    pub fn add(self: *Stats, other: Stats) void {
+        self.draw_calls += other.draw_calls;
+        self.instances += other.instances;
+        self.culled += other.culled;
+    }
+};
+
+/// Returns true if the renderer supports drawing with instance data buffers.
+pub fn isInstancingSupported() bool {
+    const caps = zbgfx.bgfx.getCaps();
+    return caps.*.supported & zbgfx.bgfx.CapsFlags_Instancing != 0;
+}
+
+/// Collects the visible meshes for a material type so they can be sorted and drawn in batches.
+/// Items are sorted by material then mesh, and consecutive items that share both are drawn with a
+/// single instanced submit. The Material type must provide 'sortKey' and 'eql'.
+pub fn RenderQueue(comptime Material: type) type {
+    return struct {
+        const Self = @This();
+
+        pub const Item = struct {
+            key: u64,
+            mesh: Meshes.Mesh.Handle,
+            material: Material,
+            transform: Mat,
+            normal: Mat,
+            tint: Vec = .splat(1.0),
+        };
+
+        /// A run of items that share the same mesh and material.
+        pub const Batch = struct {
+            mesh: Meshes.Mesh.Handle,
+            material: *const Material,
+            items: []const Item,
+        };
+
+        pub const BatchIterator = struct {
+            items: []const Item,
+            index: usize = 0,
+
+            pub fn next(self: *BatchIterator) ?Batch {
+                if (self.index >= self.items.len) {
+                    return null;
+                }
+
+                const first = &self.items[self.index];
+                var end = self.index + 1;
+                while (end < self.items.len) : (end += 1) {
+                    const item = &self.items[end];
+                    if (!item.mesh.eql(first.mesh) or !item.material.eql(first.material)) {
+                        break;
+                    }
+                }
+
+                const result: Batch = .{
+                    .mesh = first.mesh,
+                    .material = &first.material,
+                    .items = self.items[self.index..end],
+                };
+                self.index = end;
+                return result;
+            }
+        };
+
+        items: std.ArrayListUnmanaged(Item) = .empty,
+        stats: Stats = .{},
+
+        pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
+            self.items.deinit(allocator);
+        }
+
+        pub fn clear(self: *Self) void {
+            self.items.clearRetainingCapacity();
+            self.stats = .{};
+        }
+
+        pub fn push(
+            self: *Self,
+            allocator: std.mem.Allocator,
+            mesh: Meshes.Mesh.Handle,
+            material: Material,
+            transform: Mat,
+            normal: Mat,
+            tint: Vec,
+        ) !void {
+            try self.items.append(allocator, .{
+                .key = (@as(u64, material.sortKey()) << 32) | mesh.id,
+                .mesh = mesh,
+                .material = material,
+                .transform = transform,
+                .normal = normal,
+                .tint = tint,
+            });
+        }
+
+        pub fn sort(self: *Self) void {
+            std.sort.pdq(Item, self.items.items, {}, lessThan);
+        }
+
+        pub fn batches(self: Self) BatchIterator {
+            return .{
+                .items = self.items.items,
+            };
+        }
+
+        fn lessThan(_: void, lhs: Item, rhs: Item) bool {
+            return lhs.key < rhs.key;
+        }
+    };
+}
+
+/// Fills an instance data buffer with the given items. Returns the number of items written, which
+/// may be less than requested if bgfx has run out of instance data for this frame.
+pub fn allocInstances(
+    buffer: *zbgfx.bgfx.InstanceDataBuffer,
+    items: anytype,
+) u32 {
+    const requested: u32 = @intCast(items.len);
+    const available = zbgfx.bgfx.getAvailInstanceDataBuffer(requested, instance_stride);
+    if (available == 0) {
+        return 0;
+    }
+
+    zbgfx.bgfx.allocInstanceDataBuffer(buffer, available, instance_stride);
+
+    const data: [*]InstanceData = @ptrCast(@alignCast(buffer.data));
+    for (items[0..available], data[0..available]) |item, *instance| {
+        instance.* = .{
+            .model = item.transform.toArray(),
+            .tint = item.tint.toArray(),
+        };
+    }
+
+    return available;
+}
+
+test "batches" {
+    const allocator = std.testing.allocator;
+
+    const Material = struct {
+        id: u32,
+
+        pub fn sortKey(self: @This()) u32 {
+            return self.id;
+        }
+
+        pub fn eql(self: @This(), other: @This()) bool {
+            return self.id == other.id;
+        }
+    };
+
+    var queue: RenderQueue(Material) = .{};
+    defer queue.deinit(allocator);
+
+    const mesh_a: Meshes.Mesh.Handle = .init(0);
+    const mesh_b: Meshes.Mesh.Handle = .init(1);
+
+    try queue.push(allocator, mesh_b, .{ .id = 1 }, .identity, .identity, .splat(1.0));
+    try queue.push(allocator, mesh_a, .{ .id = 1 }, .identity, .identity, .splat(1.0));
+    try queue.push(allocator, mesh_a, .{ .id = 0 }, .identity, .identity, .splat(1.0));
+    try queue.push(allocator, mesh_b, .{ .id = 1 }, .identity, .identity, .splat(1.0));
+    try queue.push(allocator, mesh_a, .{ .id = 1 }, .identity, .identity, .splat(1.0));
+    queue.sort();
+
+    var it = queue.batches();
+
+    const first = it.next().?;
+    try std.testing.expectEqual(0, first.material.id);
+    try std.testing.expect(first.mesh.eql(mesh_a));
+    try std.testing.expectEqual(1, first.items.len);
+
+    const second = it.next().?;
+    try std.testing.expectEqual(1, second.material.id);
+    try std.testing.expect(second.mesh.eql(mesh_a));
+    try std.testing.expectEqual(2, second.items.len);
+
+    const third = it.next().?;
+    try std.testing.expect(third.mesh.eql(mesh_b));
+    try std.testing.expectEqual(2, third.items.len);
+
+    try std.testing.expectEqual(null, it.next());
+}
+
+test "phong batches" {
+    const allocator = std.testing.allocator;
+    const Phong = render.ecs.components.Phong;
+
+    var queue: RenderQueue(Phong) = .{};
+    defer queue.deinit(allocator);
+
+    const mesh: Meshes.Mesh.Handle = .init(0);
+    const red: Phong = .{ .diffuse_color = .init(1.0, 0.0, 0.0, 1.0) };
+    const blue: Phong = .{ .diffuse_color = .init(0.0, 0.0, 1.0, 1.0) };
+
+    for (0..4) |_| {
+        try queue.push(allocator, mesh, red, .identity, .identity, .splat(1.0));
+        try queue.push(allocator, mesh, blue, .identity, .identity, .splat(1.0));
+    }
+    queue.sort();
+
+    // Materials that share textures but not colors are still drawn in one batch each.
+    var it = queue.batches();
+    try std.testing.expectEqual(4, it.next().?.items.len);
+    try std.testing.expectEqual(4, it.next().?.items.len);
+    try std.testing.expectEqual(null, it.next());
+}
@@ -1,11 +1,14 @@
+pub const AssetLoader = @import("AssetLoader.zig");
 pub const Atlas = @import("Atlas.zig");
 pub const Commands = @import("Commands.zig");
 pub const ecs = @import("ecs/root.zig");
 pub const Font = @import("Font.zig");
 pub const Fonts = @import("Fonts.zig");
 pub const MemFactory = @import("MemFactory.zig");
+pub const mesh_cache = @import("mesh_cache.zig");
 pub const Meshes = @import("Meshes.zig");
 pub const RenderBuffer = @import("RenderBuffer.zig");
+pub const render_queue = @import("render_queue.zig");
 pub const Renderer = @import("Renderer.zig");
 pub const shaders = @import("shaders/root.zig");
 pub const shapes = @import("shapes.zig");
@@ -16,6 +19,8 @@ pub const View = @import("View.zig");
 const std = @import("std");
 const vertex_buffer = @import("vertex_buffer.zig");
 
+pub const RenderQueue = render_queue.RenderQueue;
+
 pub const Vertex = vertex_buffer.Vertex;
 pub const VertexBuffer16 = vertex_buffer.VertexBuffer(Vertex, u16);
 pub const VertexBuffer32 = vertex_buffer.VertexBuffer(Vertex, u32);
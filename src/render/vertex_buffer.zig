@@ -220,6 +220,7 @@ pub fn VertexBufferUploads(comptime VertexType: type, comptime IndexType: type)
             vertex_complete: bool = false,
             index_complete: bool = false,
             buffer: VertexBufferType,
+            render_buffer: RenderBuffer = .{},
 
             fn is_complete(self: Upload) bool {
                 return self.vertex_complete and self.index_complete;
@@ -250,9 +251,14 @@ pub fn VertexBufferUploads(comptime VertexType: type, comptime IndexType: type)
         ) !RenderBuffer {
             const allocator = mem_factory.allocator;
 
+            // The upload only takes ownership of the buffer once nothing else can fail, so the
+            // caller still owns it if an error is returned.
+            try self.uploads.ensureUnusedCapacity(allocator, 1);
             const upload: *Upload = try allocator.create(Upload);
-            upload.buffer = buffer;
-            try self.uploads.append(allocator, upload);
+            errdefer allocator.destroy(upload);
+            upload.* = .{
+                .buffer = buffer,
+            };
 
             var result: RenderBuffer = .init();
             try result.setStaticBuffer(mem_factory, buffer, .{
@@ -260,9 +266,22 @@ pub fn VertexBufferUploads(comptime VertexType: type, comptime IndexType: type)
                 .on_upload_indices = onUploadIndices,
                 .user_data = upload,
             });
+            upload.render_buffer = result;
+            self.uploads.appendAssumeCapacity(upload);
             return result;
         }
 
+        /// Returns true while the data of the given buffer is waiting to be uploaded to the GPU.
+        pub fn isUploading(self: Self, buffer: RenderBuffer) bool {
+            for (self.uploads.items) |upload| {
+                if (std.meta.eql(upload.render_buffer.vertex, buffer.vertex)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
         pub fn update(self: *Self, allocator: std.mem.Allocator) void {
             var i: usize = 0;
             while (i < self.uploads.items.len) {
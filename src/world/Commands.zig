@@ -0,0 +1,244 @@
+const Components = @import("Components.zig");
+const std = @import("std");
+const world = @import("root.zig");
+
+const Entity = world.Entity;
+const Signature = Components.Signature;
+const World = world.World;
+
+/// Records structural changes to the world, such as inserting or removing components and
+/// destroying entities. The changes are applied together at the end of a schedule. This allows
+/// systems to make structural changes while iterating their queries, and each changed entity only
+/// updates the queries once no matter how many of its components were changed.
+///
+/// Recording commands is thread-safe so systems running in parallel can share the buffer.
+const Self = @This();
+
+const Command = union(enum) {
+    insert: Insert,
+    remove: Remove,
+    destroy: Entity,
+};
+
+const Insert = struct {
+    const DestroyFn = *const fn (ptr: ?*anyopaque, allocator: std.mem.Allocator) void;
+
+    entity: Entity,
+    component: Components.Id,
+    /// Null for marker components.
+    data: ?*anyopaque,
+    size: usize,
+    destroy_fn: DestroyFn,
+};
+
+const Remove = struct {
+    entity: Entity,
+    component: Components.Id,
+};
+
+commands: std.ArrayListUnmanaged(Command) = .empty,
+/// The signature of each changed entity before any commands were applied.
+_changed: std.AutoArrayHashMapUnmanaged(Entity, Signature) = .empty,
+_mutex: std.Thread.Mutex = .{},
+_world: *World,
+
+pub fn init(_world: *World) Self {
+    return .{
+        ._world = _world,
+    };
+}
+
+pub fn deinit(self: *Self) void {
+    const allocator = self._world._allocator;
+    self.clear();
+    self.commands.deinit(allocator);
+    self._changed.deinit(allocator);
+}
+
+/// Inserts the component when the commands are applied. If the entity already has this
+/// component, the existing component is replaced.
+pub fn insert(self: *Self, entity: Entity, component: anytype) !void {
+    const T = @TypeOf(component);
+    const allocator = self._world._allocator;
+
+    const id = self._world.components.getComponentId(T) orelse {
+        std.debug.panic(
+            "Failed to queue component '{s}'. Component not registered.",
+            .{@typeName(T)},
+        );
+    };
+
+    const data: ?*anyopaque = if (@sizeOf(T) == 0) null else blk: {
+        const result = try allocator.create(T);
+        result.* = component;
+        break :blk result;
+    };
+    errdefer Data(T).destroy(data, allocator);
+
+    self._mutex.lock();
+    defer self._mutex.unlock();
+
+    try self.commands.append(allocator, .{
+        .insert = .{
+            .entity = entity,
+            .component = id,
+            .data = data,
+            .size = @sizeOf(T),
+            .destroy_fn = Data(T).destroy,
+        },
+    });
+}
+
+pub fn insertComponents(self: *Self, entity: Entity, components: anytype) !void {
+    inline for (std.meta.fields(@TypeOf(components))) |field| {
+        try self.insert(entity, @field(components, field.name));
+    }
+}
+
+pub fn remove(self: *Self, comptime T: type, entity: Entity) !void {
+    const id = self._world.components.getComponentId(T) orelse {
+        std.debug.panic(
+            "Failed to queue component '{s}' removal. Component not registered.",
+            .{@typeName(T)},
+        );
+    };
+
+    self._mutex.lock();
+    defer self._mutex.unlock();
+
+    try self.commands.append(self._world._allocator, .{
+        .remove = .{
+            .entity = entity,
+            .component = id,
+        },
+    });
+}
+
+pub fn destroy(self: *Self, entity: Entity) !void {
+    self._mutex.lock();
+    defer self._mutex.unlock();
+
+    try self.commands.append(self._world._allocator, .{
+        .destroy = entity,
+    });
+}
+
+/// Reserves the entity's id immediately so the handle can be used by other commands. The entity
+/// is created and its components are inserted when the commands are applied. Until then the
+/// entity isn't alive.
+pub fn spawn(self: *Self, components: anytype) !Entity {
+    const entity = try self._world.entities.reserve();
+    try self.insertComponents(entity, components);
+    return entity;
+}
+
+pub fn isEmpty(self: Self) bool {
+    return self.commands.items.len == 0 and self._world.entities.numReserved() == 0;
+}
+
+/// Applies all recorded commands in order. Commands on stale entities are ignored.
+pub fn apply(self: *Self) !void {
+    const _world = self._world;
+    const allocator = _world._allocator;
+    defer self.clear();
+
+    try _world.entities.flushReserved(allocator);
+
+    for (self.commands.items) |command| {
+        switch (command) {
+            .insert => |item| {
+                if (!_world.isAlive(item.entity)) {
+                    continue;
+                }
+
+                try self.trackChange(item.entity);
+
+                if (item.data) |data| {
+                    if (_world.components.getById(item.component, item.entity)) |existing| {
+                        const dst: [*]u8 = @ptrCast(existing);
+                        const src: [*]const u8 = @ptrCast(data);
+                        @memcpy(dst[0..item.size], src[0..item.size]);
+                    } else {
+                        try _world.components.insertById(
+                            allocator,
+                            item.component,
+                            item.entity,
+                            data,
+                        );
+                    }
+                }
+
+                _world.entities.setSignatureBit(item.entity, item.component);
+            },
+            .remove => |item| {
+                if (!_world.isAlive(item.entity)) {
+                    continue;
+                }
+
+                const signature = _world.entities.getSignature(item.entity);
+                if (!signature.isSet(item.component)) {
+                    continue;
+                }
+
+                try self.trackChange(item.entity);
+                try _world.components.removeById(allocator, item.component, item.entity);
+                _world.entities.unsetSignatureBit(item.entity, item.component);
+            },
+            .destroy => |entity| {
+                if (!_world.isAlive(entity)) {
+                    continue;
+                }
+
+                // The queries still reflect the signature before this batch, which may differ
+                // from the current signature.
+                if (self._changed.fetchSwapRemove(entity)) |entry| {
+                    _world.queries.entityDestroyed(entity, entry.value);
+                }
+
+                try _world.destroyEntity(entity);
+            },
+        }
+    }
+
+    var it = self._changed.iterator();
+    while (it.next()) |entry| {
+        const entity = entry.key_ptr.*;
+        const signature = _world.entities.getSignature(entity);
+        try _world.queries.signatureChanged(allocator, entity, entry.value_ptr.*, signature);
+    }
+}
+
+fn trackChange(self: *Self, entity: Entity) !void {
+    const result = try self._changed.getOrPut(self._world._allocator, entity);
+    if (!result.found_existing) {
+        result.value_ptr.* = self._world.entities.getSignature(entity);
+    }
+}
+
+fn clear(self: *Self) void {
+    const allocator = self._world._allocator;
+
+    for (self.commands.items) |command| {
+        switch (command) {
+            .insert => |item| item.destroy_fn(item.data, allocator),
+            else => {},
+        }
+    }
+
+    self.commands.clearRetainingCapacity();
+    self._changed.clearRetainingCapacity();
+}
+
+fn Data(comptime T: type) type {
+    return struct {
+        fn destroy(ptr: ?*anyopaque, allocator: std.mem.Allocator) void {
+            if (@sizeOf(T) == 0) {
+                return;
+            }
+
+            const data = ptr orelse return;
+            const component: *T = @ptrCast(@alignCast(data));
+            allocator.destroy(component);
+        }
+    };
+}
@@ -15,8 +15,10 @@ const Self = @This();
 /// a query, etc.
 pub const Id = u32;
 
-const Arrays = std.AutoHashMapUnmanaged(Id, IArray);
+/// Arrays are indexed by the component Id. Marker components do not have an array.
+const Arrays = std.ArrayListUnmanaged(?IArray);
 const Types = std.StringHashMapUnmanaged(Id);
+const TypeKeys = std.AutoHashMapUnmanaged(usize, Id);
 
 pub const max: usize = 512;
 pub const Signature = std.StaticBitSet(max);
@@ -24,31 +26,38 @@ pub const Signature = std.StaticBitSet(max);
 _id: Id = 0,
 _arrays: Arrays = .empty,
 _types: Types = .empty,
+_type_keys: TypeKeys = .empty,
 
 pub fn init() Self {
     return .{};
 }
 
 pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
-    var it = self._arrays.valueIterator();
-    while (it.next()) |array| {
+    for (self._arrays.items) |entry| {
+        const array = entry orelse continue;
         array.deinit_fn(array.ptr, allocator);
     }
     self._arrays.deinit(allocator);
     self._types.deinit(allocator);
+    self._type_keys.deinit(allocator);
 }
 
 pub fn register(self: *Self, comptime T: type, allocator: std.mem.Allocator) !void {
     const id = self._id;
+    std.debug.assert(id == self._arrays.items.len);
 
     // Check for marker components. These are components with no memory layout. If it is one,
     // don't create an Array for this component. Just register the Id.
     if (@sizeOf(T) > 0) {
         var array: *Array(T) = try .init(allocator);
-        try self._arrays.put(allocator, id, array.interface());
+        errdefer array.deinit(allocator);
+        try self._arrays.append(allocator, array.interface());
+    } else {
+        try self._arrays.append(allocator, null);
     }
 
     try self._types.put(allocator, @typeName(T), id);
+    try self._type_keys.put(allocator, typeKey(T), id);
     self._id += 1;
 }
 
@@ -63,9 +72,8 @@ pub fn insert(
         return Error.InvalidEntity;
     }
 
-    const key = @typeName(T);
-    const type_id = self._types.get(key) orelse return;
-    const array = self._arrays.get(type_id) orelse return;
+    const type_id = self.getComponentId(T) orelse return;
+    const array = self._arrays.items[type_id] orelse return;
     try array.insert_fn(array.ptr, allocator, entity, @constCast(&component));
 }
 
@@ -80,20 +88,32 @@ pub fn insertById(
         return Error.InvalidEntity;
     }
 
-    const array = self._arrays.get(id) orelse return;
+    const array = self.getInterface(id) orelse return;
     try array.insert_fn(array.ptr, allocator, entity, component);
 }
 
 pub fn remove(self: *Self, comptime T: type, allocator: std.mem.Allocator, entity: Entity) !void {
-    const key = @typeName(T);
-    const type_id = self._types.get(key) orelse return;
-    const array = self._arrays.get(type_id) orelse return;
+    const type_id = self.getComponentId(T) orelse return;
+    const array = self._arrays.items[type_id] orelse return;
     try array.remove_fn(array.ptr, allocator, entity);
 }
 
-pub fn entityDestroyed(self: Self, allocator: std.mem.Allocator, entity: Entity) !void {
-    var it = self._arrays.valueIterator();
-    while (it.next()) |array| {
+pub fn removeById(self: *Self, allocator: std.mem.Allocator, id: Id, entity: Entity) !void {
+    const array = self.getInterface(id) orelse return;
+    try array.remove_fn(array.ptr, allocator, entity);
+}
+
+/// Removes all components of a destroyed entity. Only the arrays for the components set in the
+/// given signature are visited.
+pub fn entityDestroyed(
+    self: Self,
+    allocator: std.mem.Allocator,
+    entity: Entity,
+    signature: Signature,
+) !void {
+    var it = signature.iterator(.{});
+    while (it.next()) |component| {
+        const array = self.getInterface(@intCast(component)) orelse continue;
         try array.entity_destroyed_fn(array.ptr, allocator, entity);
     }
 }
@@ -103,11 +123,20 @@ pub fn get(self: Self, comptime T: type, entity: Entity) ?*T {
         return null;
     }
 
-    const key = @typeName(T);
-    const type_id = self._types.get(key) orelse return null;
-    const array = self._arrays.get(type_id) orelse return null;
-    const result = array.get_fn(array.ptr, entity) orelse return null;
-    return @ptrCast(@alignCast(result));
+    const array = self.getArray(T) orelse return null;
+    return array.getMut(entity);
+}
+
+/// Retrieves the typed storage for the given component. This allows systems to iterate the
+/// densely packed components directly. Returns null for unregistered and marker components.
+pub fn getArray(self: Self, comptime T: type) ?*Array(T) {
+    if (@sizeOf(T) == 0) {
+        return null;
+    }
+
+    const type_id = self.getComponentId(T) orelse return null;
+    const array = self._arrays.items[type_id] orelse return null;
+    return @ptrCast(@alignCast(array.ptr));
 }
 
 pub fn getById(self: Self, id: Id, entity: Entity) ?*anyopaque {
@@ -115,13 +144,12 @@ pub fn getById(self: Self, id: Id, entity: Entity) ?*anyopaque {
         return null;
     }
 
-    const array = self._arrays.get(id) orelse return null;
+    const array = self.getInterface(id) orelse return null;
     return array.get_fn(array.ptr, entity);
 }
 
 pub fn getComponentId(self: Self, comptime T: type) ?Id {
-    const key = @typeName(T);
-    return self._types.get(key);
+    return self._type_keys.get(typeKey(T));
 }
 
 pub fn getComponentIdByName(self: Self, component: []const u8) ?Id {
@@ -139,6 +167,24 @@ pub fn getComponentNameById(self: Self, component: Id) ?[]const u8 {
     return null;
 }
 
+fn getInterface(self: Self, id: Id) ?IArray {
+    if (id >= self._arrays.items.len) {
+        return null;
+    }
+
+    return self._arrays.items[id];
+}
+
+/// Generates a unique address for each type. This is used as a cheaper key than the type name
+/// when looking up the id of a component.
+fn typeKey(comptime T: type) usize {
+    const Key = struct {
+        const Type = T;
+        var byte: u8 = 0;
+    };
+    return @intFromPtr(&Key.byte);
+}
+
 const IArray = struct {
     const DeinitFn = *const fn (ptr: *anyopaque, allocator: std.mem.Allocator) void;
     const InsertFn = *const fn (
@@ -167,29 +213,54 @@ const IArray = struct {
     get_fn: GetFn,
 };
 
-/// Holds all components for a specific component type.
-fn Array(comptime T: type) type {
+/// Holds all components for a specific component type. The components are stored in a sparse
+/// set. The dense arrays hold the components and their owning entities contiguously so they can be
+/// iterated directly, while the sparse array maps an entity id to its index in the dense arrays.
+///
+/// Components that declare 'pub const track_changes = true' record every entity whose component
+/// is inserted or accessed mutably in 'changed', so consumers only need to visit those entities.
+pub fn Array(comptime T: type) type {
     return struct {
         const ArraySelf = @This();
 
+        pub const Index = u32;
+        pub const invalid_index: Index = std.math.maxInt(Index);
+
         pub const empty: ArraySelf = .{};
 
+        pub const tracks_changes = @hasDecl(T, "track_changes") and T.track_changes;
+
         components: std.ArrayListUnmanaged(T) = .empty,
-        entity_to_index: std.AutoHashMapUnmanaged(Entity.Id, usize) = .empty,
-        index_to_entity: std.AutoHashMapUnmanaged(usize, Entity.Id) = .empty,
+        entities: std.ArrayListUnmanaged(Entity) = .empty,
+        sparse: std.ArrayListUnmanaged(Index) = .empty,
+        /// The entities changed since the last call to 'clearChanged'. An entity may appear more
+        /// than once, or may no longer have the component.
+        changed: std.ArrayListUnmanaged(Entity) = .empty,
+        /// Whether each component in the dense array is in 'changed'. Set atomically since
+        /// systems that only read a component may still fetch it mutably in parallel.
+        _changed_flags: std.ArrayListUnmanaged(std.atomic.Value(bool)) = .empty,
+        _changed_mutex: std.Thread.Mutex = .{},
 
         pub fn init(allocator: std.mem.Allocator) !*ArraySelf {
             const result = try allocator.create(ArraySelf);
+            errdefer allocator.destroy(result);
+
+            var components: std.ArrayListUnmanaged(T) = try .initCapacity(allocator, 255);
+            errdefer components.deinit(allocator);
+
             result.* = .{
-                .components = try .initCapacity(allocator, 255),
+                .components = components,
+                .entities = try .initCapacity(allocator, 255),
             };
             return result;
         }
 
         pub fn deinit(self: *ArraySelf, allocator: std.mem.Allocator) void {
             self.components.deinit(allocator);
-            self.entity_to_index.deinit(allocator);
-            self.index_to_entity.deinit(allocator);
+            self.entities.deinit(allocator);
+            self.sparse.deinit(allocator);
+            self.changed.deinit(allocator);
+            self._changed_flags.deinit(allocator);
             allocator.destroy(self);
         }
 
@@ -199,50 +270,127 @@ fn Array(comptime T: type) type {
             entity: Entity,
             component: T,
         ) !void {
-            std.debug.assert(!self.entity_to_index.contains(entity.id));
+            std.debug.assert(entity.id >= self.sparse.items.len or
+                self.sparse.items[entity.id] == invalid_index);
 
-            const index = self.components.items.len;
+            if (entity.id >= self.sparse.items.len) {
+                const count = entity.id - self.sparse.items.len + 1;
+                try self.sparse.appendNTimes(allocator, invalid_index, count);
+            }
 
-            try self.entity_to_index.put(allocator, entity.id, index);
-            try self.index_to_entity.put(allocator, index, entity.id);
+            if (tracks_changes) {
+                // Every live component can be marked at most once on top of what is already in
+                // 'changed', so reserving for all of them means marking never has to allocate.
+                const needed = self.changed.items.len + self.components.items.len + 1;
+                try self.changed.ensureTotalCapacity(allocator, needed);
+                try self._changed_flags.append(allocator, .init(false));
+            }
+            errdefer {
+                if (tracks_changes) {
+                    _ = self._changed_flags.pop();
+                }
+            }
 
             try self.components.append(allocator, component);
-        }
+            errdefer _ = self.components.pop();
+            try self.entities.append(allocator, entity);
+
+            const index: Index = @intCast(self.entities.items.len - 1);
+            self.sparse.items[entity.id] = index;
 
-        pub fn remove(self: *ArraySelf, allocator: std.mem.Allocator, entity: Entity) !void {
-            std.debug.assert(self.entity_to_index.contains(entity.id));
+            if (tracks_changes) {
+                self.markChanged(index);
+            }
+        }
 
-            const removed_index = self.entity_to_index.get(entity.id) orelse {
+        pub fn remove(self: *ArraySelf, entity: Entity) void {
+            const removed_index = self.indexOf(entity) orelse {
                 std.debug.panic("Failed to retrieve component index for entity: {}.", .{
                     entity.id,
                 });
             };
-            const last_index = self.components.items.len - 1;
+
+            // The last element is moved into the removed slot, so its sparse entry needs to
+            // point to the new location. The removed entity is cleared last in case it was the
+            // last element.
+            const last_entity = self.entities.items[self.entities.items.len - 1];
             _ = self.components.swapRemove(removed_index);
+            _ = self.entities.swapRemove(removed_index);
+            if (tracks_changes) {
+                _ = self._changed_flags.swapRemove(removed_index);
+            }
 
-            const last_entity = self.index_to_entity.get(last_index) orelse {
-                std.debug.panic("Failed to entity id for component index: {}.", .{
-                    last_index,
-                });
-            };
-            try self.entity_to_index.put(allocator, last_entity, removed_index);
-            try self.index_to_entity.put(allocator, removed_index, last_entity);
+            self.sparse.items[last_entity.id] = removed_index;
+            self.sparse.items[entity.id] = invalid_index;
+        }
 
-            _ = self.entity_to_index.remove(entity.id);
-            _ = self.index_to_entity.remove(last_index);
+        pub fn entityDestroyed(self: *ArraySelf, entity: Entity) void {
+            if (self.contains(entity)) {
+                self.remove(entity);
+            }
         }
 
-        pub fn entityDestroyed(self: *ArraySelf, allocator: std.mem.Allocator, entity: Entity) !void {
-            if (self.entity_to_index.contains(entity.id)) {
-                try self.remove(allocator, entity);
+        pub fn contains(self: ArraySelf, entity: Entity) bool {
+            return self.indexOf(entity) != null;
+        }
+
+        pub fn indexOf(self: ArraySelf, entity: Entity) ?Index {
+            if (entity.id >= self.sparse.items.len) {
+                return null;
+            }
+
+            const index = self.sparse.items[entity.id];
+            if (index == invalid_index) {
+                return null;
+            }
+
+            // Stale handles share the id of the current entity but not the generation.
+            if (self.entities.items[index].generation != entity.generation) {
+                return null;
             }
+
+            return index;
         }
 
+        /// Marks the component as changed if changes are tracked.
         pub fn getMut(self: *ArraySelf, entity: Entity) ?*T {
-            const index = self.entity_to_index.get(entity.id) orelse return null;
+            const index = self.indexOf(entity) orelse return null;
+            if (tracks_changes) {
+                self.markChanged(index);
+            }
+            return &self.components.items[index];
+        }
+
+        pub fn get(self: *const ArraySelf, entity: Entity) ?*const T {
+            const index = self.indexOf(entity) orelse return null;
             return &self.components.items[index];
         }
 
+        /// Empties 'changed'. Only the entities in 'changed' are visited. Not synchronized with
+        /// marking, so the calling system must declare the component as a write to keep any
+        /// system that marks it out of the same level.
+        pub fn clearChanged(self: *ArraySelf) void {
+            for (self.changed.items) |entity| {
+                const index = self.indexOf(entity) orelse continue;
+                self._changed_flags.items[index].store(false, .monotonic);
+            }
+            self.changed.clearRetainingCapacity();
+        }
+
+        fn markChanged(self: *ArraySelf, index: Index) void {
+            if (self._changed_flags.items[index].swap(true, .monotonic)) {
+                return;
+            }
+
+            self._changed_mutex.lock();
+            defer self._changed_mutex.unlock();
+            self.changed.appendAssumeCapacity(self.entities.items[index]);
+        }
+
+        pub fn len(self: ArraySelf) usize {
+            return self.components.items.len;
+        }
+
         fn onDeinit(ptr: *anyopaque, allocator: std.mem.Allocator) void {
             const self = fromPtr(ptr);
             self.deinit(allocator);
@@ -264,13 +412,15 @@ fn Array(comptime T: type) type {
             allocator: std.mem.Allocator,
             entity: Entity,
         ) !void {
+            _ = allocator;
             const self = fromPtr(ptr);
-            try self.remove(allocator, entity);
+            self.remove(entity);
         }
 
         fn onEntityDestroyed(ptr: *anyopaque, allocator: std.mem.Allocator, entity: Entity) !void {
+            _ = allocator;
             const self = fromPtr(ptr);
-            try self.entityDestroyed(allocator, entity);
+            self.entityDestroyed(entity);
         }
 
         fn onGet(ptr: *anyopaque, entity: Entity) ?*anyopaque {
@@ -294,3 +444,75 @@ fn Array(comptime T: type) type {
         }
     };
 }
+
+test "change tracking" {
+    const allocator = std.testing.allocator;
+
+    const Tracked = struct {
+        pub const track_changes = true;
+        value: u32 = 0,
+    };
+
+    var array: *Array(Tracked) = try .init(allocator);
+    defer array.deinit(allocator);
+
+    const a: Entity = .{ .id = 0 };
+    const b: Entity = .{ .id = 1 };
+    try array.insert(allocator, a, .{});
+    try array.insert(allocator, b, .{});
+    try std.testing.expectEqualSlices(Entity, &.{ a, b }, array.changed.items);
+
+    array.clearChanged();
+    try std.testing.expectEqual(0, array.changed.items.len);
+
+    // Reading doesn't mark the component, and each change is only recorded once.
+    _ = array.get(a);
+    array.getMut(b).?.value = 1;
+    array.getMut(b).?.value = 2;
+    try std.testing.expectEqualSlices(Entity, &.{b}, array.changed.items);
+
+    // Removing an entity keeps the flags of the moved component in place.
+    array.remove(a);
+    array.clearChanged();
+    array.getMut(b).?.value = 3;
+    try std.testing.expectEqualSlices(Entity, &.{b}, array.changed.items);
+}
+
+test "change tracking after clear" {
+    const allocator = std.testing.allocator;
+
+    const Tracked = struct {
+        pub const track_changes = true;
+        value: u32 = 0,
+    };
+
+    var array: *Array(Tracked) = try .init(allocator);
+    defer array.deinit(allocator);
+
+    var entities: [9]Entity = undefined;
+    for (&entities, 0..) |*entity, id| {
+        entity.* = .{ .id = @intCast(id) };
+    }
+
+    for (entities[0..8]) |entity| {
+        try array.insert(allocator, entity, .{});
+    }
+    array.clearChanged();
+
+    // Marking every component after a clear must fit in what the inserts reserved.
+    try array.insert(allocator, entities[8], .{});
+    for (entities[0..8]) |entity| {
+        array.getMut(entity).?.value = 1;
+    }
+    try std.testing.expectEqual(9, array.changed.items.len);
+
+    // Marked entries of removed components stay in 'changed' until the next clear.
+    array.clearChanged();
+    array.getMut(entities[0]).?.value = 2;
+    array.remove(entities[0]);
+    try array.insert(allocator, .{ .id = 9 }, .{});
+    for (entities[1..]) |entity| {
+        array.getMut(entity).?.value = 2;
+    }
+    try std.testing.expectEqual(10, array.changed.items.len);
+}
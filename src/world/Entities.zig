@@ -6,27 +6,49 @@ const Signature = Components.Signature;
 
 pub const Entity = struct {
     pub const Id = u32;
+    pub const Generation = u32;
     pub const invalid: Entity = .{
         .id = std.math.maxInt(Id),
     };
 
     id: Id = 0,
+    /// Incremented each time an id is recycled. A handle whose generation doesn't match the
+    /// current generation of its id refers to a destroyed entity.
+    generation: Generation = 0,
 
     pub fn isValid(self: Entity) bool {
         return self.id != invalid.id;
     }
+
+    pub fn eql(self: Entity, other: Entity) bool {
+        return self.id == other.id and self.generation == other.generation;
+    }
+};
+
+pub const Error = error{
+    StaleEntity,
+    TooManyEntities,
 };
 
 const Self = @This();
 
 const EntityList = std.ArrayListUnmanaged(Entity.Id);
 
-pub const max: Entity.Id = 5000;
+/// Signatures are allocated in chunks as the number of entities grows. This keeps the address of
+/// each signature stable and avoids copying all existing signatures when growing.
+pub const chunk_size: usize = 4096;
+const Chunk = [chunk_size]Signature;
+
+/// The maximum number of ids that can be handed out. The last id is reserved for 'invalid'.
+pub const max: usize = Entity.invalid.id;
 
 deleted: EntityList = .empty,
-signatures: [max]Signature = @splat(.initEmpty()),
+generations: std.ArrayListUnmanaged(Entity.Generation) = .empty,
+chunks: std.ArrayListUnmanaged(*Chunk) = .empty,
 count: usize = 0,
-_id: Entity.Id = 0,
+/// The number of ids handed out by 'reserve' that haven't been created yet. Reserved ids follow
+/// the last id in 'generations'.
+_reserved: std.atomic.Value(usize) = .init(0),
 
 pub fn init(allocator: std.mem.Allocator) Self {
     _ = allocator;
@@ -34,47 +56,241 @@ pub fn init(allocator: std.mem.Allocator) Self {
 }
 
 pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
+    for (self.chunks.items) |chunk| {
+        allocator.destroy(chunk);
+    }
+    self.chunks.deinit(allocator);
+    self.generations.deinit(allocator);
     self.deleted.deinit(allocator);
 }
 
-pub fn create(self: *Self) Entity {
-    const id = blk: {
-        if (self.deleted.pop()) |id| {
-            break :blk id;
-        } else {
-            const id = self._id;
-            self._id += 1;
-            break :blk id;
-        }
-    };
+pub fn create(self: *Self, allocator: std.mem.Allocator) !Entity {
+    var result: [1]Entity = undefined;
+    try self.createMany(allocator, &result);
+    return result[0];
+}
 
-    std.debug.assert(self._id < max);
-    self.count += 1;
+/// Fills the given slice with new entities. Recycled ids are handed out first.
+pub fn createMany(self: *Self, allocator: std.mem.Allocator, entities: []Entity) !void {
+    try self.flushReserved(allocator);
+
+    const recycled = @min(self.deleted.items.len, entities.len);
+    const first = self.generations.items.len;
+    const new_len = first + entities.len - recycled;
+    if (new_len > max) {
+        return Error.TooManyEntities;
+    }
+
+    try self.ensureTotalCapacity(allocator, new_len);
+    try self.generations.appendNTimes(allocator, 0, new_len - first);
+
+    for (entities[0..recycled]) |*entity| {
+        const id = self.deleted.pop().?;
+        entity.* = .{
+            .id = id,
+            .generation = self.generations.items[id],
+        };
+    }
+
+    for (entities[recycled..], first..) |*entity, id| {
+        entity.* = .{
+            .id = @intCast(id),
+        };
+    }
+
+    self.count += entities.len;
+}
+
+/// Returns the handle of an entity that is created by the next call to 'flushReserved'. The entity
+/// isn't alive until then. Safe to call from multiple threads as long as no entities are created
+/// or destroyed at the same time. World checks this in debug builds, since systems that may run in
+/// parallel can only change entities through Commands.
+pub fn reserve(self: *Self) !Entity {
+    const offset = self._reserved.fetchAdd(1, .monotonic);
+    const id = self.generations.items.len + offset;
+    if (id >= max) {
+        _ = self._reserved.fetchSub(1, .monotonic);
+        return Error.TooManyEntities;
+    }
 
     return .{
-        .id = id,
+        .id = @intCast(id),
     };
 }
 
+pub fn numReserved(self: Self) usize {
+    return self._reserved.load(.monotonic);
+}
+
+/// Creates all entities handed out by 'reserve'.
+pub fn flushReserved(self: *Self, allocator: std.mem.Allocator) !void {
+    const reserved = self._reserved.load(.monotonic);
+    if (reserved == 0) {
+        return;
+    }
+
+    const new_len = self.generations.items.len + reserved;
+    try self.ensureTotalCapacity(allocator, new_len);
+    try self.generations.appendNTimes(allocator, 0, reserved);
+
+    self.count += reserved;
+    self._reserved.store(0, .monotonic);
+}
+
 pub fn destroy(self: *Self, allocator: std.mem.Allocator, entity: Entity) !void {
+    if (!self.isAlive(entity)) {
+        return Error.StaleEntity;
+    }
+
     try self.deleted.append(allocator, entity.id);
+    self.release(entity);
+}
 
-    self.signatures[entity.id] = .initEmpty();
-    self.count -= 1;
+/// Destroys all given entities. Stale handles are ignored. Returns the number of entities that
+/// were destroyed.
+pub fn destroyMany(
+    self: *Self,
+    allocator: std.mem.Allocator,
+    entities: []const Entity,
+) !usize {
+    try self.deleted.ensureUnusedCapacity(allocator, entities.len);
+
+    var result: usize = 0;
+    for (entities) |entity| {
+        if (!self.isAlive(entity)) {
+            continue;
+        }
+
+        self.deleted.appendAssumeCapacity(entity.id);
+        self.release(entity);
+        result += 1;
+    }
+
+    return result;
+}
+
+pub fn isAlive(self: Self, entity: Entity) bool {
+    if (entity.id >= self.generations.items.len) {
+        return false;
+    }
+
+    return self.generations.items[entity.id] == entity.generation;
 }
 
 pub fn setSignatureBit(self: *Self, entity: Entity, index: usize) void {
-    self.signatures[entity.id].set(index);
+    std.debug.assert(self.isAlive(entity));
+    self.getSignaturePtr(entity.id).set(index);
 }
 
 pub fn unsetSignatureBit(self: *Self, entity: Entity, index: usize) void {
-    self.signatures[entity.id].unset(index);
+    std.debug.assert(self.isAlive(entity));
+    self.getSignaturePtr(entity.id).unset(index);
 }
 
 pub fn setSignature(self: *Self, entity: Entity, signature: Signature) void {
-    self.signatures[entity.id] = signature;
+    std.debug.assert(self.isAlive(entity));
+    self.getSignaturePtr(entity.id).* = signature;
 }
 
+/// Returns an empty signature for stale or invalid entities.
 pub fn getSignature(self: Self, entity: Entity) Signature {
-    return self.signatures[entity.id];
+    if (!self.isAlive(entity)) {
+        return .initEmpty();
+    }
+
+    return self.getSignaturePtr(entity.id).*;
+}
+
+fn getSignaturePtr(self: Self, id: Entity.Id) *Signature {
+    const chunk = self.chunks.items[id / chunk_size];
+    return &chunk[id % chunk_size];
+}
+
+fn release(self: *Self, entity: Entity) void {
+    self.generations.items[entity.id] +%= 1;
+    self.getSignaturePtr(entity.id).* = .initEmpty();
+    self.count -= 1;
+}
+
+fn ensureTotalCapacity(self: *Self, allocator: std.mem.Allocator, capacity: usize) !void {
+    const num_chunks = std.math.divCeil(usize, capacity, chunk_size) catch unreachable;
+    try self.chunks.ensureTotalCapacity(allocator, num_chunks);
+
+    while (self.chunks.items.len < num_chunks) {
+        const chunk = try allocator.create(Chunk);
+        @memset(chunk, Signature.initEmpty());
+        self.chunks.appendAssumeCapacity(chunk);
+    }
+}
+
+test "generations" {
+    const allocator = std.testing.allocator;
+
+    var entities: Self = .init(allocator);
+    defer entities.deinit(allocator);
+
+    const entity = try entities.create(allocator);
+    try std.testing.expect(entities.isAlive(entity));
+
+    try entities.destroy(allocator, entity);
+    try std.testing.expect(!entities.isAlive(entity));
+    try std.testing.expectError(Error.StaleEntity, entities.destroy(allocator, entity));
+
+    const recycled = try entities.create(allocator);
+    try std.testing.expectEqual(entity.id, recycled.id);
+    try std.testing.expectEqual(entity.generation + 1, recycled.generation);
+    try std.testing.expect(entities.isAlive(recycled));
+    try std.testing.expect(!entities.isAlive(entity));
+}
+
+test "create many" {
+    const allocator = std.testing.allocator;
+
+    var entities: Self = .init(allocator);
+    defer entities.deinit(allocator);
+
+    const handles = try allocator.alloc(Entity, chunk_size * 2 + 1);
+    defer allocator.free(handles);
+
+    try entities.createMany(allocator, handles);
+    try std.testing.expectEqual(handles.len, entities.count);
+    try std.testing.expectEqual(3, entities.chunks.items.len);
+
+    for (handles, 0..) |handle, i| {
+        try std.testing.expectEqual(i, handle.id);
+    }
+
+    entities.setSignatureBit(handles[handles.len - 1], 4);
+    try std.testing.expect(entities.getSignature(handles[handles.len - 1]).isSet(4));
+
+    const destroyed = try entities.destroyMany(allocator, handles[0..10]);
+    try std.testing.expectEqual(10, destroyed);
+    try std.testing.expectEqual(0, try entities.destroyMany(allocator, handles[0..10]));
+    try std.testing.expectEqual(handles.len - 10, entities.count);
+}
+
+test "reserve" {
+    const allocator = std.testing.allocator;
+
+    var entities: Self = .init(allocator);
+    defer entities.deinit(allocator);
+
+    const created = try entities.create(allocator);
+    try entities.destroy(allocator, created);
+
+    // Reserved ids are never recycled, since the deleted list can't be shared between threads.
+    const first = try entities.reserve();
+    const second = try entities.reserve();
+    try std.testing.expectEqual(1, first.id);
+    try std.testing.expectEqual(2, second.id);
+    try std.testing.expect(!entities.isAlive(first));
+
+    try entities.flushReserved(allocator);
+    try std.testing.expect(entities.isAlive(first));
+    try std.testing.expect(entities.isAlive(second));
+    try std.testing.expectEqual(2, entities.count);
+    try std.testing.expectEqual(0, entities.numReserved());
+
+    const recycled = try entities.create(allocator);
+    try std.testing.expectEqual(created.id, recycled.id);
 }
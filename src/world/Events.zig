@@ -3,13 +3,27 @@ const std = @import("std");
 const world = @import("root.zig");
 
 const SystemId = world.Systems.SystemId;
+const World = world.World;
 
 /// Systems that can be triggered through an event.
 const Self = @This();
 
 pub const Event = u32;
 
+/// A copy of an event that is dispatched later.
+const Queued = struct {
+    const DispatchFn = *const fn (ptr: ?*anyopaque, _world: *World) void;
+    const DestroyFn = *const fn (ptr: ?*anyopaque, allocator: std.mem.Allocator) void;
+
+    /// Null for events without any data.
+    ptr: ?*anyopaque,
+    dispatch_fn: DispatchFn,
+    destroy_fn: DestroyFn,
+};
+
 items: std.AutoHashMapUnmanaged(Event, std.ArrayListUnmanaged(SystemId)) = .empty,
+_queued: std.ArrayListUnmanaged(Queued) = .empty,
+_mutex: std.Thread.Mutex = .{},
 
 pub fn init() Self {
     return .{};
@@ -21,6 +35,11 @@ pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
         systems.deinit(allocator);
     }
     self.items.deinit(allocator);
+
+    for (self._queued.items) |item| {
+        item.destroy_fn(item.ptr, allocator);
+    }
+    self._queued.deinit(allocator);
 }
 
 pub fn add(self: *Self, allocator: std.mem.Allocator, comptime T: type) !void {
@@ -64,3 +83,61 @@ pub fn getListeners(self: Self, comptime T: type) []const SystemId {
     };
     return systems.items;
 }
+
+/// Copies the event so it can be dispatched later. Thread-safe.
+pub fn queue(self: *Self, allocator: std.mem.Allocator, event: anytype) !void {
+    const T = @TypeOf(event);
+
+    const ptr: ?*anyopaque = if (@sizeOf(T) == 0) null else blk: {
+        const result = try allocator.create(T);
+        result.* = event;
+        break :blk result;
+    };
+    errdefer Data(T).destroy(ptr, allocator);
+
+    self._mutex.lock();
+    defer self._mutex.unlock();
+
+    try self._queued.append(allocator, .{
+        .ptr = ptr,
+        .dispatch_fn = Data(T).dispatch,
+        .destroy_fn = Data(T).destroy,
+    });
+}
+
+/// Triggers the queued events in the order they were queued. Must not be called while events are
+/// being queued.
+pub fn dispatchQueued(self: *Self, _world: *World) void {
+    const allocator = _world._allocator;
+
+    // Listeners run immediately here, so the queue can't grow while it is dispatched.
+    for (self._queued.items) |item| {
+        item.dispatch_fn(item.ptr, _world);
+        item.destroy_fn(item.ptr, allocator);
+    }
+    self._queued.clearRetainingCapacity();
+}
+
+fn Data(comptime T: type) type {
+    return struct {
+        fn dispatch(ptr: ?*anyopaque, _world: *World) void {
+            if (@sizeOf(T) == 0) {
+                _world.triggerEvent(T{});
+                return;
+            }
+
+            const event: *T = @ptrCast(@alignCast(ptr.?));
+            _world.triggerEvent(event.*);
+        }
+
+        fn destroy(ptr: ?*anyopaque, allocator: std.mem.Allocator) void {
+            if (@sizeOf(T) == 0) {
+                return;
+            }
+
+            const data = ptr orelse return;
+            const event: *T = @ptrCast(@alignCast(data));
+            allocator.destroy(event);
+        }
+    };
+}
@@ -0,0 +1,365 @@
+const Components = @import("Components.zig");
+const core = @import("core");
+const std = @import("std");
+const world = @import("root.zig");
+
+const Child = world.components.core.Child;
+const Entity = world.Entity;
+const Mat = core.math.Mat;
+const Transform = world.components.core.Transform;
+const World = world.World;
+
+/// Caches every entity with a Transform in topological order, where parents are always placed
+/// before their children. This allows resolving the world matrices of an arbitrarily deep
+/// hierarchy in a single pass. Only the entities whose Transform was changed, along with their
+/// descendants, are visited and recomputed. The order is only rebuilt when an entity gains or
+/// loses a Transform or Child, or when an entity is reparented.
+///
+/// This consumes the changes recorded for Transform and Child, so nothing else may clear them.
+const Self = @This();
+
+const Index = u32;
+const none: Index = std.math.maxInt(Index);
+
+pub const Node = struct {
+    entity: Entity,
+    /// The index of the parent node, or 'none' for roots.
+    parent: Index,
+    /// The parent the node was built with. Used to detect reparenting.
+    parent_entity: Entity,
+    first_child: Index = none,
+    next_sibling: Index = none,
+    world: Mat = .identity,
+    normal: Mat = .identity,
+    dirty: bool = true,
+};
+
+nodes: std.MultiArrayList(Node) = .empty,
+/// The nodes that were recomputed in the last update, in topological order.
+resolved: std.ArrayListUnmanaged(Index) = .empty,
+_transforms_version: u32 = 0,
+_children_version: u32 = 0,
+_built: bool = false,
+/// Maps an entity id to its node. Only valid for ids of entities in 'nodes'.
+_lookup: std.ArrayListUnmanaged(Index) = .empty,
+// Scratch buffers used while rebuilding. Indexed by the position within the transform set.
+_parents: std.ArrayListUnmanaged(Index) = .empty,
+_depths: std.ArrayListUnmanaged(Index) = .empty,
+_counts: std.ArrayListUnmanaged(Index) = .empty,
+_stack: std.ArrayListUnmanaged(Index) = .empty,
+
+pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
+    self.nodes.deinit(allocator);
+    self.resolved.deinit(allocator);
+    self._lookup.deinit(allocator);
+    self._parents.deinit(allocator);
+    self._depths.deinit(allocator);
+    self._counts.deinit(allocator);
+    self._stack.deinit(allocator);
+}
+
+/// Brings the cached order and matrices up to date with the changed Transform and Child
+/// components. 'entities' must be every entity with a Transform and is only used when the order
+/// is rebuilt. The recomputed nodes are stored in 'resolved' in topological order. The changes of
+/// both components are cleared, so the calling system must declare them as writes.
+pub fn update(
+    self: *Self,
+    allocator: std.mem.Allocator,
+    _world: *const World,
+    entities: []const Entity,
+    transforms_version: u32,
+    children_version: u32,
+) !void {
+    self.resolved.clearRetainingCapacity();
+
+    const transforms = _world.components.getArray(Transform) orelse return;
+    const children = _world.components.getArray(Child);
+    defer {
+        transforms.clearChanged();
+        if (children) |array| {
+            array.clearChanged();
+        }
+    }
+
+    if (self.isStale(children, transforms_version, children_version)) {
+        try self.rebuild(allocator, _world, entities, transforms_version, children_version);
+
+        // New and reparented nodes are dirty after a rebuild.
+        for (self.nodes.items(.dirty), 0..) |is_dirty, i| {
+            if (is_dirty) {
+                try self.resolved.append(allocator, @intCast(i));
+            }
+        }
+    }
+
+    const slice = self.nodes.slice();
+    const dirty = slice.items(.dirty);
+    const parents = slice.items(.parent);
+    const first_children = slice.items(.first_child);
+    const next_siblings = slice.items(.next_sibling);
+    const worlds = slice.items(.world);
+    const normals = slice.items(.normal);
+
+    for (transforms.changed.items) |entity| {
+        const index = self.indexOf(entity) orelse continue;
+        if (!dirty[index]) {
+            dirty[index] = true;
+            try self.resolved.append(allocator, index);
+        }
+    }
+
+    // Every descendant of a changed node must be recomputed as well. 'resolved' grows while it is
+    // walked, so descendants of descendants are visited too.
+    var i: usize = 0;
+    while (i < self.resolved.items.len) : (i += 1) {
+        var child = first_children[self.resolved.items[i]];
+        while (child != none) : (child = next_siblings[child]) {
+            if (!dirty[child]) {
+                dirty[child] = true;
+                try self.resolved.append(allocator, child);
+            }
+        }
+    }
+
+    // Node indices are in topological order, so sorting places parents before their children.
+    std.mem.sort(Index, self.resolved.items, {}, std.sort.asc(Index));
+
+    // Resolve the matrices in batches over the changed nodes.
+    const nodes_entities = slice.items(.entity);
+    for (self.resolved.items) |index| {
+        if (transforms.get(nodes_entities[index])) |transform| {
+            worlds[index] = transform.toMatrix();
+        }
+    }
+
+    for (self.resolved.items) |index| {
+        const parent = parents[index];
+        if (parent != none) {
+            worlds[index] = worlds[index].mul(worlds[parent]);
+        }
+    }
+
+    for (self.resolved.items) |index| {
+        normals[index] = worlds[index].inverse().transpose();
+    }
+
+    for (self.resolved.items) |index| {
+        dirty[index] = false;
+    }
+}
+
+/// Returns true if the cached order no longer matches the given query versions or the parent of
+/// a changed Child differs from the one the order was built with.
+fn isStale(
+    self: Self,
+    children: ?*const Components.Array(Child),
+    transforms_version: u32,
+    children_version: u32,
+) bool {
+    if (!self._built or
+        self._transforms_version != transforms_version or
+        self._children_version != children_version)
+    {
+        return true;
+    }
+
+    const array = children orelse return false;
+    const parents = self.nodes.items(.parent_entity);
+    for (array.changed.items) |entity| {
+        const index = self.indexOf(entity) orelse continue;
+        const child = array.get(entity) orelse continue;
+        if (!child.parent.eql(parents[index])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+fn indexOf(self: Self, entity: Entity) ?Index {
+    if (entity.id >= self._lookup.items.len) {
+        return null;
+    }
+
+    const index = self._lookup.items[entity.id];
+    if (index == none or !self.nodes.items(.entity)[index].eql(entity)) {
+        return null;
+    }
+
+    return index;
+}
+
+/// Rebuilds the topological order from the given set of entities, which must all have a
+/// Transform. Nodes that existed before with the same parent keep their cached matrices.
+fn rebuild(
+    self: *Self,
+    allocator: std.mem.Allocator,
+    _world: *const World,
+    entities: []const Entity,
+    transforms_version: u32,
+    children_version: u32,
+) !void {
+    const count = entities.len;
+
+    // Map each entity id to its position within 'entities'.
+    var max_id: usize = 0;
+    for (entities) |entity| {
+        max_id = @max(max_id, entity.id + 1);
+    }
+    for (self.nodes.items(.entity)) |entity| {
+        max_id = @max(max_id, entity.id + 1);
+    }
+
+    try self._lookup.resize(allocator, max_id);
+    @memset(self._lookup.items, none);
+    for (entities, 0..) |entity, i| {
+        self._lookup.items[entity.id] = @intCast(i);
+    }
+
+    // Resolve the parent of each entity. Parents without a Transform are treated as roots.
+    try self._parents.resize(allocator, count);
+    for (entities, self._parents.items) |entity, *parent| {
+        parent.* = none;
+
+        const child = _world.readComponent(Child, entity) orelse continue;
+        if (!child.parent.isValid() or child.parent.id >= self._lookup.items.len) {
+            continue;
+        }
+
+        const index = self._lookup.items[child.parent.id];
+        if (index != none and entities[index].eql(child.parent)) {
+            parent.* = index;
+        }
+    }
+
+    try self.computeDepths(allocator, entities);
+
+    // Counting sort by depth so every parent is placed before its children.
+    var max_depth: Index = 0;
+    for (self._depths.items) |depth| {
+        max_depth = @max(max_depth, depth);
+    }
+
+    try self._counts.resize(allocator, @as(usize, max_depth) + 1);
+    @memset(self._counts.items, 0);
+    for (self._depths.items) |depth| {
+        self._counts.items[depth] += 1;
+    }
+
+    var offset: Index = 0;
+    for (self._counts.items) |*depth_count| {
+        const num = depth_count.*;
+        depth_count.* = offset;
+        offset += num;
+    }
+
+    // '_stack' now holds the sorted position of each entity.
+    try self._stack.resize(allocator, count);
+    for (self._depths.items, self._stack.items) |depth, *position| {
+        position.* = self._counts.items[depth];
+        self._counts.items[depth] += 1;
+    }
+
+    var nodes: std.MultiArrayList(Node) = .empty;
+    errdefer nodes.deinit(allocator);
+    try nodes.resize(allocator, count);
+
+    for (entities, 0..) |entity, i| {
+        const parent = self._parents.items[i];
+        const child = _world.readComponent(Child, entity);
+
+        nodes.set(self._stack.items[i], .{
+            .entity = entity,
+            .parent = if (parent == none) none else self._stack.items[parent],
+            .parent_entity = if (child) |c| c.parent else .invalid,
+        });
+    }
+
+    // Carry over the cached matrices from the previous order. '_lookup' is reused to map entity
+    // ids to their new index.
+    @memset(self._lookup.items, none);
+    for (nodes.items(.entity), 0..) |entity, i| {
+        self._lookup.items[entity.id] = @intCast(i);
+    }
+
+    const old = self.nodes.slice();
+    for (0..old.len) |i| {
+        const entity = old.items(.entity)[i];
+        const index = self._lookup.items[entity.id];
+        if (index == none) {
+            continue;
+        }
+
+        // The node must still be attached to the same parent for its matrices to be valid.
+        var node = nodes.get(index);
+        const parent = getParentEntity(nodes.slice(), node.parent);
+        const old_parent = getParentEntity(old, old.items(.parent)[i]);
+        if (!node.entity.eql(entity) or !parent.eql(old_parent)) {
+            continue;
+        }
+
+        node.world = old.items(.world)[i];
+        node.normal = old.items(.normal)[i];
+        node.dirty = old.items(.dirty)[i];
+        nodes.set(index, node);
+    }
+
+    // Link the children of each node. Walking backwards keeps each sibling list in index order.
+    const new = nodes.slice();
+    var i = new.len;
+    while (i > 0) {
+        i -= 1;
+        const parent = new.items(.parent)[i];
+        if (parent != none) {
+            new.items(.next_sibling)[i] = new.items(.first_child)[parent];
+            new.items(.first_child)[parent] = @intCast(i);
+        }
+    }
+
+    self.nodes.deinit(allocator);
+    self.nodes = nodes;
+    self._transforms_version = transforms_version;
+    self._children_version = children_version;
+    self._built = true;
+}
+
+fn getParentEntity(nodes: std.MultiArrayList(Node).Slice, parent: Index) Entity {
+    return if (parent == none) .invalid else nodes.items(.entity)[parent];
+}
+
+/// Computes the depth of each entity within the hierarchy. Cycles are broken by turning the
+/// entity that closes the cycle into a root.
+fn computeDepths(self: *Self, allocator: std.mem.Allocator, entities: []const Entity) !void {
+    const visiting: Index = none - 1;
+    const parents = self._parents.items;
+
+    try self._depths.resize(allocator, entities.len);
+    @memset(self._depths.items, none);
+    const depths = self._depths.items;
+
+    for (0..entities.len) |i| {
+        // Walk up until a root or a node with a known depth is found.
+        self._stack.clearRetainingCapacity();
+        var current: Index = @intCast(i);
+        while (current != none and depths[current] == none) {
+            depths[current] = visiting;
+            try self._stack.append(allocator, current);
+
+            const parent = parents[current];
+            if (parent != none and depths[parent] == visiting) {
+                std.log.warn(
+                    "Entity {} is a part of a transform cycle. Treating it as a root.",
+                    .{entities[current].id},
+                );
+                parents[current] = none;
+            }
+            current = parents[current];
+        }
+
+        var depth: Index = if (current == none) 0 else depths[current] + 1;
+        while (self._stack.pop()) |index| {
+            depths[index] = depth;
+            depth += 1;
+        }
+    }
+}
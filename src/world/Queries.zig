@@ -3,12 +3,128 @@ const std = @import("std");
 const world = @import("root.zig");
 
 const Entity = world.Entity;
-const HashSetUnmanaged = world.HashSetUnmanaged;
 const Signature = Components.Signature;
+const World = world.World;
 
-pub const EntitySet = HashSetUnmanaged(Entity);
+/// The set of entities matching a query. Entities are stored densely so iterating a query walks
+/// contiguous memory. The sparse array maps an entity id to its index in the dense array.
+/// Removing an entity swaps the last entity into its place, so the set must not be modified
+/// while it is being iterated.
+pub const EntitySet = struct {
+    const Index = u32;
+    const invalid_index: Index = std.math.maxInt(Index);
 
-/// Generate a query for a system.
+    pub const empty: EntitySet = .{};
+
+    pub const Iterator = struct {
+        items: []const Entity,
+        index: usize = 0,
+
+        pub fn next(self: *Iterator) ?*const Entity {
+            if (self.index >= self.items.len) {
+                return null;
+            }
+
+            const result = &self.items[self.index];
+            self.index += 1;
+            return result;
+        }
+    };
+
+    items: std.ArrayListUnmanaged(Entity) = .empty,
+    sparse: std.ArrayListUnmanaged(Index) = .empty,
+    /// Incremented each time an entity is inserted or removed. Allows caches built from the set
+    /// to detect when they are out of date.
+    version: u32 = 0,
+
+    pub fn deinit(self: *EntitySet, allocator: std.mem.Allocator) void {
+        self.items.deinit(allocator);
+        self.sparse.deinit(allocator);
+    }
+
+    pub fn contains(self: EntitySet, entity: Entity) bool {
+        return self.indexOf(entity) != null;
+    }
+
+    pub fn count(self: EntitySet) usize {
+        return self.items.items.len;
+    }
+
+    pub fn isEmpty(self: EntitySet) bool {
+        return self.count() == 0;
+    }
+
+    /// Inserts the entity if it is not already a part of this set.
+    pub fn insert(self: *EntitySet, allocator: std.mem.Allocator, entity: Entity) !void {
+        if (self.contains(entity)) {
+            return;
+        }
+
+        if (entity.id >= self.sparse.items.len) {
+            const num = entity.id - self.sparse.items.len + 1;
+            try self.sparse.appendNTimes(allocator, invalid_index, num);
+        }
+
+        try self.items.append(allocator, entity);
+        self.sparse.items[entity.id] = @intCast(self.items.items.len - 1);
+        self.version +%= 1;
+    }
+
+    pub fn remove(self: *EntitySet, entity: Entity) bool {
+        const index = self.indexOf(entity) orelse return false;
+
+        const last = self.items.items[self.items.items.len - 1];
+        _ = self.items.swapRemove(index);
+
+        self.sparse.items[last.id] = index;
+        self.sparse.items[entity.id] = invalid_index;
+        self.version +%= 1;
+        return true;
+    }
+
+    pub fn iterator(self: EntitySet) Iterator {
+        return .{
+            .items = self.items.items,
+        };
+    }
+
+    pub fn slice(self: EntitySet) []const Entity {
+        return self.items.items;
+    }
+
+    fn indexOf(self: EntitySet, entity: Entity) ?Index {
+        if (entity.id >= self.sparse.items.len) {
+            return null;
+        }
+
+        const index = self.sparse.items[entity.id];
+        if (index == invalid_index or !self.items.items[index].eql(entity)) {
+            return null;
+        }
+
+        return index;
+    }
+};
+
+/// Marks a component within a query as read-only. Systems that only read the same components can
+/// be run concurrently.
+pub fn Read(comptime T: type) type {
+    return struct {
+        pub const Component = T;
+        pub const read_only = true;
+    };
+}
+
+pub fn isReadOnly(comptime T: type) bool {
+    return @typeInfo(T) == .@"struct" and @hasDecl(T, "read_only") and T.read_only;
+}
+
+/// Returns the component type for a query component, unwrapping any access markers.
+pub fn ComponentType(comptime T: type) type {
+    return if (isReadOnly(T)) T.Component else T;
+}
+
+/// Generate a query for a system. Components are mutable unless they are wrapped with 'Read'.
 pub fn Query(comptime components: []const type) type {
     return struct {
         const QuerySelf = @This();
@@ -35,6 +151,151 @@ pub fn Query(comptime components: []const type) type {
             const entities = self.entities orelse return false;
             return entities.contains(entity);
         }
+
+        /// Changes whenever an entity enters or leaves this query.
+        pub fn getVersion(self: QuerySelf) u32 {
+            const entities = self.entities orelse return 0;
+            return entities.version;
+        }
+
+        /// Iterates the densely packed component arrays directly. The smallest component array
+        /// drives the iteration and every other component is retrieved by index, so no hashing
+        /// is performed per entity. The returned items are invalidated by any structural change
+        /// to the world such as inserting or removing components.
+        pub fn iter(self: QuerySelf, _world: *const World) Iterator {
+            var result: Iterator = .{
+                .arrays = @splat(null),
+                .entities = self.entities,
+            };
+
+            var smallest: usize = std.math.maxInt(usize);
+            inline for (components, 0..) |QueryComponent, i| {
+                const Component = ComponentType(QueryComponent);
+                if (@sizeOf(Component) > 0) {
+                    const array = _world.components.getArray(Component) orelse {
+                        result.driver = &.{};
+                        return result;
+                    };
+
+                    result.arrays[i] = array;
+                    if (array.len() < smallest) {
+                        smallest = array.len();
+                        result.driver = array.entities.items;
+                    }
+                }
+            }
+
+            return result;
+        }
+
+        pub const Item = struct {
+            entity: Entity,
+            _components: [components.len]?*anyopaque,
+
+            /// Read-only components are returned as const pointers.
+            pub fn get(self: Item, comptime T: type) Pointer(T) {
+                const index = comptime componentIndex(T);
+                return @ptrCast(@alignCast(self._components[index].?));
+            }
+
+            fn Pointer(comptime T: type) type {
+                return if (isReadOnly(components[componentIndex(T)])) *const T else *T;
+            }
+
+            fn componentIndex(comptime T: type) usize {
+                if (@sizeOf(T) == 0) {
+                    @compileError(std.fmt.comptimePrint(
+                        "Marker component '{s}' does not contain any data.",
+                        .{@typeName(T)},
+                    ));
+                }
+
+                for (components, 0..) |Component, i| {
+                    if (ComponentType(Component) == T) {
+                        return i;
+                    }
+                }
+
+                @compileError(std.fmt.comptimePrint(
+                    "Component '{s}' is not a part of query '{s}'.",
+                    .{ @typeName(T), @typeName(QuerySelf) },
+                ));
+            }
+        };
+
+        pub const Iterator = struct {
+            const has_markers = blk: {
+                var has_data = false;
+                var result = false;
+                for (components) |Component| {
+                    if (@sizeOf(ComponentType(Component)) == 0) {
+                        result = true;
+                    } else {
+                        has_data = true;
+                    }
+                }
+
+                if (!has_data) {
+                    @compileError(std.fmt.comptimePrint(
+                        "Query '{s}' only contains marker components and can't be iterated. " ++
+                            "Use 'getEntities' instead.",
+                        .{@typeName(QuerySelf)},
+                    ));
+                }
+
+                break :blk result;
+            };
+
+            arrays: [components.len]?*anyopaque,
+            driver: []const Entity = &.{},
+            entities: ?*const EntitySet,
+            index: usize = 0,
+
+            pub fn next(self: *Iterator) ?Item {
+                while (self.index < self.driver.len) {
+                    const entity = self.driver[self.index];
+                    self.index += 1;
+
+                    // Marker components don't have any storage, so fall back to the query's
+                    // entity set to verify the entity has them.
+                    if (has_markers) {
+                        const entities = self.entities orelse return null;
+                        if (!entities.contains(entity)) {
+                            continue;
+                        }
+                    }
+
+                    if (self.getItem(entity)) |item| {
+                        return item;
+                    }
+                }
+
+                return null;
+            }
+
+            fn getItem(self: Iterator, entity: Entity) ?Item {
+                var result: Item = .{
+                    .entity = entity,
+                    ._components = @splat(null),
+                };
+
+                inline for (components, 0..) |QueryComponent, i| {
+                    const Component = ComponentType(QueryComponent);
+                    if (@sizeOf(Component) > 0) {
+                        const array: *Components.Array(Component) = @ptrCast(@alignCast(
+                            self.arrays[i].?,
+                        ));
+                        // Read-only components don't mark the component as changed.
+                        result._components[i] = if (isReadOnly(QueryComponent))
+                            @constCast(array.get(entity) orelse return null)
+                        else
+                            array.getMut(entity) orelse return null;
+                    }
+                }
+
+                return result;
+            }
+        };
     };
 }
 
@@ -59,7 +320,7 @@ pub inline fn isQueryType(comptime query: type) bool {
     }
 
     const entities = struct_info.fields[1];
-    if (entities.type != ?*const HashSetUnmanaged(Entity)) {
+    if (entities.type != ?*const EntitySet) {
         return false;
     }
 
@@ -69,19 +330,31 @@ pub inline fn isQueryType(comptime query: type) bool {
 /// Holds the list of entities per query that can be used for Systems, Events, etc.
 const Self = @This();
 
-entries: std.AutoHashMapUnmanaged(Signature, IQuery) = .empty,
+/// Indices into 'queries' for each component. Used to only visit the queries that are affected
+/// when a component is inserted or removed.
+const QueryIndices = std.ArrayListUnmanaged(u32);
+
+entries: std.AutoHashMapUnmanaged(Signature, u32) = .empty,
+queries: std.ArrayListUnmanaged(IQuery) = .empty,
+by_component: std.ArrayListUnmanaged(QueryIndices) = .empty,
 
 pub fn init() Self {
     return .{};
 }
 
 pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
-    var it = self.entries.valueIterator();
-    while (it.next()) |query| {
-        query.entities.*.deinit(allocator);
+    for (self.queries.items) |query| {
+        query.entities.deinit(allocator);
         allocator.destroy(query.entities);
         query.vtable.deinit(query.ptr, allocator);
     }
+    self.queries.deinit(allocator);
+
+    for (self.by_component.items) |*indices| {
+        indices.deinit(allocator);
+    }
+    self.by_component.deinit(allocator);
+
     self.entries.deinit(allocator);
 }
 
@@ -91,8 +364,8 @@ pub fn add(
     allocator: std.mem.Allocator,
     signature: Signature,
 ) !*const EntitySet {
-    if (self.entries.contains(signature)) {
-        return self.entries.getPtr(signature).?.entities;
+    if (self.entries.get(signature)) |index| {
+        return self.queries.items[index].entities;
     }
 
     const entities = try allocator.create(EntitySet);
@@ -105,39 +378,84 @@ pub fn add(
         .entities = entities,
     };
 
-    try self.entries.put(allocator, signature, generateIQuery(QueryType, query, entities));
+    const index: u32 = @intCast(self.queries.items.len);
+    try self.queries.ensureUnusedCapacity(allocator, 1);
+    try self.entries.put(allocator, signature, index);
+    errdefer _ = self.entries.remove(signature);
+
+    // The index is removed from the lists it was added to if a later append fails, otherwise the
+    // next query added would reuse the index and receive this query's signature changes.
+    var num_appended: usize = 0;
+    errdefer {
+        var undo = signature.iterator(.{});
+        for (0..num_appended) |_| {
+            const component = undo.next() orelse break;
+            _ = self.by_component.items[component].pop();
+        }
+    }
+
+    var it = signature.iterator(.{});
+    while (it.next()) |component| {
+        if (component >= self.by_component.items.len) {
+            const num = component - self.by_component.items.len + 1;
+            try self.by_component.appendNTimes(allocator, .empty, num);
+        }
+
+        try self.by_component.items[component].append(allocator, index);
+        num_appended += 1;
+    }
+
+    self.queries.appendAssumeCapacity(generateIQuery(QueryType, query, entities, signature));
 
     return entities;
 }
 
 pub fn get(self: Self, signature: Signature) ?*anyopaque {
-    const query = self.entries.get(signature) orelse return null;
-    return query.ptr;
+    const index = self.entries.get(signature) orelse return null;
+    return self.queries.items[index].ptr;
 }
 
+/// Updates the entity sets of all queries that reference a component that differs between the
+/// old and new signature. Queries that don't reference any changed component are not visited.
 pub fn signatureChanged(
     self: *Self,
     allocator: std.mem.Allocator,
-    signature: Signature,
     entity: Entity,
+    old: Signature,
+    new: Signature,
 ) !void {
-    var it = self.entries.iterator();
-    while (it.next()) |entry| {
-        const query = entry.key_ptr.*;
-        const intersection = query.intersectWith(signature);
+    const changed = old.xorWith(new);
+
+    var it = changed.iterator(.{});
+    while (it.next()) |component| {
+        if (component >= self.by_component.items.len) {
+            continue;
+        }
+
+        for (self.by_component.items[component].items) |index| {
+            const query = self.queries.items[index];
+            const intersection = query.signature.intersectWith(new);
 
-        if (intersection.eql(query)) {
-            try entry.value_ptr.entities.insert(allocator, entity);
-        } else {
-            _ = entry.value_ptr.entities.remove(entity);
+            if (intersection.eql(query.signature)) {
+                try query.entities.insert(allocator, entity);
+            } else {
+                _ = query.entities.remove(entity);
+            }
         }
     }
 }
 
-pub fn entityDestroyed(self: *Self, entity: Entity) void {
-    var it = self.entries.valueIterator();
-    while (it.next()) |query| {
-        _ = query.entities.remove(entity);
+/// Removes the entity from all queries that reference any component in the given signature.
+pub fn entityDestroyed(self: *Self, entity: Entity, signature: Signature) void {
+    var it = signature.iterator(.{});
+    while (it.next()) |component| {
+        if (component >= self.by_component.items.len) {
+            continue;
+        }
+
+        for (self.by_component.items[component].items) |index| {
+            _ = self.queries.items[index].entities.remove(entity);
+        }
     }
 }
 
@@ -148,10 +466,16 @@ const IQuery = struct {
 
     ptr: *anyopaque,
     entities: *EntitySet,
+    signature: Signature,
     vtable: VTable,
 };
 
-fn generateIQuery(comptime T: type, ptr: *anyopaque, entities: *EntitySet) IQuery {
+fn generateIQuery(
+    comptime T: type,
+    ptr: *anyopaque,
+    entities: *EntitySet,
+    signature: Signature,
+) IQuery {
     const Bindings = struct {
         fn deinit(_ptr: *anyopaque, allocator: std.mem.Allocator) void {
             const query: *T = @ptrCast(@alignCast(_ptr));
@@ -162,8 +486,76 @@ fn generateIQuery(comptime T: type, ptr: *anyopaque, entities: *EntitySet) IQuer
     return .{
         .ptr = ptr,
         .entities = entities,
+        .signature = signature,
         .vtable = .{
             .deinit = Bindings.deinit,
         },
     };
 }
+
+test "entity set" {
+    const allocator = std.testing.allocator;
+
+    var set: EntitySet = .empty;
+    defer set.deinit(allocator);
+
+    const a: Entity = .{ .id = 0 };
+    const b: Entity = .{ .id = 4 };
+    const c: Entity = .{ .id = 2 };
+
+    try set.insert(allocator, a);
+    try set.insert(allocator, b);
+    try set.insert(allocator, c);
+    try set.insert(allocator, b);
+    try std.testing.expectEqual(3, set.count());
+
+    try std.testing.expect(set.remove(a));
+    try std.testing.expect(!set.remove(a));
+    try std.testing.expectEqual(2, set.count());
+    try std.testing.expect(set.contains(b));
+    try std.testing.expect(set.contains(c));
+
+    // Handles with a different generation are not a part of the set.
+    try std.testing.expect(!set.contains(.{ .id = 4, .generation = 1 }));
+
+    var count: usize = 0;
+    var it = set.iterator();
+    while (it.next()) |_| {
+        count += 1;
+    }
+    try std.testing.expectEqual(2, count);
+}
+
+test "add undoes the component lists on failure" {
+    const TestQuery = struct {
+        entities: ?*const EntitySet = null,
+    };
+
+    var signature: Signature = .initEmpty();
+    signature.set(1);
+    signature.set(3);
+
+    // Fail each allocation in turn until the query can be added.
+    var fail_index: usize = 0;
+    while (true) : (fail_index += 1) {
+        var failing: std.testing.FailingAllocator = .init(std.testing.allocator, .{
+            .fail_index = fail_index,
+        });
+        const allocator = failing.allocator();
+
+        var queries: Self = .init();
+        defer queries.deinit(allocator);
+
+        if (queries.add(TestQuery, allocator, signature)) |_| {
+            try std.testing.expectEqualSlices(u32, &.{0}, queries.by_component.items[1].items);
+            try std.testing.expectEqualSlices(u32, &.{0}, queries.by_component.items[3].items);
+            break;
+        } else |err| {
+            try std.testing.expectEqual(error.OutOfMemory, err);
+            try std.testing.expectEqual(0, queries.queries.items.len);
+            for (queries.by_component.items) |indices| {
+                try std.testing.expectEqual(0, indices.items.len);
+            }
+        }
+    }
+}
@@ -4,8 +4,21 @@ const std = @import("std");
 /// be shared across all systems.
 const Self = @This();
 const Map = std.StringHashMapUnmanaged(IResource);
+const IdMap = std.StringHashMapUnmanaged(Id);
+
+/// Identifies a resource type when tracking which resources a system accesses.
+pub const Id = u32;
+pub const max: usize = 64;
+pub const Signature = std.StaticBitSet(max);
+
+pub const Error = error{
+    TooManyResources,
+};
 
 _map: Map = .empty,
+/// Ids are assigned when a resource is added or first declared by a system, whichever comes
+/// first.
+_ids: IdMap = .empty,
 
 pub fn init() Self {
     return .{};
@@ -17,9 +30,12 @@ pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
         value.vtable.deinit(value.ptr, allocator);
     }
     self._map.deinit(allocator);
+    self._ids.deinit(allocator);
 }
 
 pub fn add(self: *Self, comptime T: type, allocator: std.mem.Allocator, resource: T) !void {
+    _ = try self.getOrAddId(allocator, T);
+
     const item = try allocator.create(T);
     item.* = resource;
     try self._map.put(allocator, @typeName(T), generateResource(T, item));
@@ -30,6 +46,25 @@ pub fn get(self: Self, comptime T: type) ?*T {
     return @ptrCast(@alignCast(result.ptr));
 }
 
+/// Returns null if the resource was never added or declared.
+pub fn getId(self: Self, comptime T: type) ?Id {
+    return self._ids.get(@typeName(T));
+}
+
+pub fn getOrAddId(self: *Self, allocator: std.mem.Allocator, comptime T: type) !Id {
+    const result = try self._ids.getOrPut(allocator, @typeName(T));
+    if (!result.found_existing) {
+        if (self._ids.count() > max) {
+            self._ids.removeByPtr(result.key_ptr);
+            return Error.TooManyResources;
+        }
+
+        result.value_ptr.* = @intCast(self._ids.count() - 1);
+    }
+
+    return result.value_ptr.*;
+}
+
 const IResource = struct {
     const VTable = struct {
         deinit: *const fn (ptr: *anyopaque, allocator: std.mem.Allocator) void,
@@ -43,6 +78,9 @@ fn generateResource(comptime T: type, ptr: *T) IResource {
     const Resource = struct {
         fn deinit(_ptr: *anyopaque, allocator: std.mem.Allocator) void {
             const resource: *T = @ptrCast(@alignCast(_ptr));
+            if (@hasDecl(T, "deinit")) {
+                resource.deinit(allocator);
+            }
             allocator.destroy(resource);
         }
     };
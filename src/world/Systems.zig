@@ -1,9 +1,12 @@
+const builtin = @import("builtin");
 const Components = @import("Components.zig");
 const core = @import("core");
+const Resources = @import("Resources.zig");
 const std = @import("std");
 const world = @import("root.zig");
 
 const Signature = Components.Signature;
+const Commands = world.Commands;
 const HashSetUnmanaged = core.containers.HashSetUnmanaged;
 const Entity = world.Entity;
 const World = world.World;
@@ -23,6 +26,12 @@ pub const SystemParam = struct {
     pub fn getComponent(self: SystemParam, comptime T: type, entity: Entity) ?*T {
         return self.world.getComponent(T, entity);
     }
+
+    /// Structural changes made through the returned buffer are applied at the end of the
+    /// current schedule.
+    pub fn commands(self: SystemParam) *Commands {
+        return &self.world.commands;
+    }
 };
 
 pub const Schedule = enum {
@@ -32,12 +41,149 @@ pub const Schedule = enum {
     postupdate,
     render,
     shutdown,
+
+    /// Only these schedules will run systems concurrently. The other schedules interact with the
+    /// platform layer or submit to the renderer and always run on the main thread.
+    pub fn isParallel(self: Schedule) bool {
+        return switch (self) {
+            .update, .postupdate => true,
+            else => false,
+        };
+    }
 };
 const schedule_count = @typeInfo(Schedule).@"enum".fields.len;
 pub const invalid_system: SystemId = 0;
 
+/// The components and resources a system accesses. Components are derived from the system's
+/// Query parameters, where components wrapped with 'Read' are read-only and all others are
+/// mutable. Anything accessed outside of the queries, such as resources, must be declared with
+/// 'Options.reads' and 'Options.writes'. Undeclared access panics in debug builds while the
+/// schedule runs in parallel.
+pub const Access = struct {
+    reads: Signature = .initEmpty(),
+    writes: Signature = .initEmpty(),
+    resource_reads: Resources.Signature = .initEmpty(),
+    resource_writes: Resources.Signature = .initEmpty(),
+    /// Conflicts with every other system. Systems that don't access anything are exclusive since
+    /// their access can't be determined.
+    exclusive: bool = false,
+    /// Systems that call into bgfx, glfw, etc. must be run on the main thread.
+    main_thread: bool = false,
+
+    pub fn conflicts(self: Access, other: Access) bool {
+        if (self.exclusive or other.exclusive) {
+            return true;
+        }
+
+        return overlaps(Signature, self.reads, self.writes, other.reads, other.writes) or
+            overlaps(
+                Resources.Signature,
+                self.resource_reads,
+                self.resource_writes,
+                other.resource_reads,
+                other.resource_writes,
+            );
+    }
+
+    pub fn isEmpty(self: Access) bool {
+        return self.reads.count() == 0 and
+            self.writes.count() == 0 and
+            self.resource_reads.count() == 0 and
+            self.resource_writes.count() == 0;
+    }
+
+    fn canReadComponent(self: Access, id: Components.Id) bool {
+        return self.reads.isSet(id) or self.writes.isSet(id);
+    }
+
+    fn canReadResource(self: Access, id: Resources.Id) bool {
+        return self.resource_reads.isSet(id) or self.resource_writes.isSet(id);
+    }
+
+    fn overlaps(
+        comptime Set: type,
+        reads: Set,
+        writes: Set,
+        other_reads: Set,
+        other_writes: Set,
+    ) bool {
+        return writes.intersectWith(other_writes).count() > 0 or
+            writes.intersectWith(other_reads).count() > 0 or
+            reads.intersectWith(other_writes).count() > 0;
+    }
+};
+
+/// Optional settings when registering a system.
+pub const Options = struct {
+    main_thread: bool = false,
+    exclusive: bool = false,
+    /// Components and resources the system reads outside of its queries.
+    reads: []const type = &.{},
+    /// Components and resources the system writes outside of its queries.
+    writes: []const type = &.{},
+};
+
+/// Whether accessing components and resources is checked against the running system's access.
+pub const verify_access = builtin.mode == .Debug;
+
+/// The access of the system running on this thread while a schedule runs in parallel.
+threadlocal var current_access: ?*const Access = null;
+
+/// Execution order for the systems of a schedule. Systems are grouped into levels where no two
+/// systems within a level conflict with each other. A system is placed one level after the last
+/// conflicting system registered before it, so conflicting systems keep their registration order.
+const Graph = struct {
+    /// Indices into the schedule's systems, sorted by level.
+    order: std.ArrayListUnmanaged(u32) = .empty,
+    /// The end index into 'order' for each level.
+    level_ends: std.ArrayListUnmanaged(u32) = .empty,
+    dirty: bool = true,
+
+    fn deinit(self: *Graph, allocator: std.mem.Allocator) void {
+        self.order.deinit(allocator);
+        self.level_ends.deinit(allocator);
+    }
+
+    fn build(self: *Graph, allocator: std.mem.Allocator, systems: []const ISystem) !void {
+        self.order.clearRetainingCapacity();
+        self.level_ends.clearRetainingCapacity();
+
+        const levels = try allocator.alloc(u32, systems.len);
+        defer allocator.free(levels);
+
+        var num_levels: u32 = 0;
+        for (systems, 0..) |system, i| {
+            var level: u32 = 0;
+            for (systems[0..i], 0..) |other, j| {
+                if (system.access.conflicts(other.access)) {
+                    level = @max(level, levels[j] + 1);
+                }
+            }
+
+            levels[i] = level;
+            num_levels = @max(num_levels, level + 1);
+        }
+
+        try self.order.ensureTotalCapacity(allocator, systems.len);
+        for (0..num_levels) |level| {
+            for (levels, 0..) |system_level, i| {
+                if (system_level == level) {
+                    self.order.appendAssumeCapacity(@intCast(i));
+                }
+            }
+
+            try self.level_ends.append(allocator, @intCast(self.order.items.len));
+        }
+
+        self.dirty = false;
+    }
+};
+
 systems: [schedule_count]std.AutoArrayHashMapUnmanaged(SystemId, ISystem) = @splat(.empty),
 standalone: std.AutoHashMapUnmanaged(SystemId, ISystem) = .empty,
+/// Systems are run serially in registration order when no pool is set.
+pool: ?*std.Thread.Pool = null,
+_graphs: [schedule_count]Graph = @splat(.{}),
 _system_id: SystemId = 1,
 
 pub fn init() Self {
@@ -53,6 +199,10 @@ pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
         systems.deinit(allocator);
     }
 
+    for (&self._graphs) |*graph| {
+        graph.deinit(allocator);
+    }
+
     var it = self.standalone.valueIterator();
     while (it.next()) |system| {
         system.deinit(allocator);
@@ -66,10 +216,12 @@ pub fn register(
     comptime system: anytype,
     params: *ParamsType(system),
     schedule: Schedule,
+    access: Access,
 ) !SystemId {
     const id = self._system_id;
     var systems = &self.systems[@intFromEnum(schedule)];
-    try systems.put(allocator, id, try generateSystem(system, allocator, params));
+    try systems.put(allocator, id, try generateSystem(system, allocator, params, access));
+    self._graphs[@intFromEnum(schedule)].dirty = true;
     self._system_id += 1;
     return id;
 }
@@ -81,36 +233,101 @@ pub fn registerStandalone(
     params: *ParamsType(system),
 ) !SystemId {
     const id = self._system_id;
-    try self.standalone.put(allocator, id, try generateSystem(system, allocator, params));
+    try self.standalone.put(allocator, id, try generateSystem(system, allocator, params, .{}));
     self._system_id += 1;
     return id;
 }
 
 pub fn unregister(self: *Self, allocator: std.mem.Allocator, system: SystemId) void {
-    for (&self.systems) |*systems| {
+    for (&self.systems, 0..) |*systems, i| {
         const entry = systems.getPtr(system) orelse continue;
         entry.deinit(allocator);
         _ = systems.orderedRemove(system);
+        self._graphs[i].dirty = true;
         break;
     }
 }
 
-pub fn run(self: *Self, schedule: Schedule) void {
-    const systems = &self.systems[@intFromEnum(schedule)];
-    var it = systems.iterator();
-    while (it.next()) |entry| {
-        const system = entry.value_ptr;
-        system.invoke() catch |err| {
-            std.debug.panic("Failed to run system: '{s}'. Error: {}.", .{
-                system.getName(),
-                err,
-            });
+/// Runs the systems of the schedule. Events triggered by systems running in parallel are dispatched
+/// after each level.
+pub fn run(self: *Self, _world: *World, schedule: Schedule) void {
+    const allocator = _world._allocator;
+    const index = @intFromEnum(schedule);
+    const systems = self.systems[index].values();
+
+    const pool = self.pool orelse return runSerial(systems);
+    if (!schedule.isParallel()) {
+        return runSerial(systems);
+    }
+
+    const graph = &self._graphs[index];
+    if (graph.dirty) {
+        graph.build(allocator, systems) catch |err| {
+            std.log.warn(
+                "Failed to build system graph for schedule '{s}'. Running serially. Error: {}.",
+                .{ @tagName(schedule), err },
+            );
+            return runSerial(systems);
         };
     }
+
+    var start: usize = 0;
+    for (graph.level_ends.items) |end| {
+        runLevel(pool, systems, graph.order.items[start..end]);
+        _world.dispatchQueuedEvents();
+        start = end;
+    }
+}
+
+/// Returns true if called from a system that may be running alongside other systems.
+pub fn isRunningInParallel() bool {
+    const access = current_access orelse return false;
+    return !access.exclusive;
+}
+
+/// Panics if the system running on this thread may run alongside other systems. Those systems
+/// must create and destroy entities or add and remove components through Commands.
+pub fn verifyStructuralChange(operation: []const u8) void {
+    if (isRunningInParallel()) {
+        std.debug.panic(
+            "'{s}' was called by a system that may run in parallel. Use Commands instead.",
+            .{operation},
+        );
+    }
+}
+
+/// Panics if the system running on this thread did not declare the component.
+pub fn verifyComponent(id: ?Components.Id, name: []const u8) void {
+    const access = current_access orelse return;
+    if (access.exclusive) {
+        return;
+    }
+
+    if (id == null or !access.canReadComponent(id.?)) {
+        std.debug.panic("Component '{s}' is accessed by a system that didn't declare it.", .{name});
+    }
+}
+
+/// Panics if the system running on this thread did not declare the resource.
+pub fn verifyResource(id: ?Resources.Id, name: []const u8) void {
+    const access = current_access orelse return;
+    if (access.exclusive) {
+        return;
+    }
+
+    if (id == null or !access.canReadResource(id.?)) {
+        std.debug.panic("Resource '{s}' is accessed by a system that didn't declare it.", .{name});
+    }
 }
 
 pub fn runId(self: Self, id: SystemId) void {
     const system = self.standalone.get(id) orelse return;
+
+    // Listeners only run while no other system is running, so their access isn't checked.
+    const previous = current_access;
+    current_access = null;
+    defer current_access = previous;
+
     system.invoke() catch |err| {
         std.debug.panic(
             "Failed to run standalone system: '{s}'. Error: {}.",
@@ -125,6 +342,53 @@ pub fn setFirstSystemParam(self: Self, id: SystemId, value: anytype) bool {
     return true;
 }
 
+fn runSerial(systems: []const ISystem) void {
+    for (systems) |system| {
+        invokeSystem(system);
+    }
+}
+
+/// Systems within a level don't conflict. The systems pinned to the main thread are run on the
+/// calling thread while the rest are run on the pool.
+fn runLevel(pool: *std.Thread.Pool, systems: []const ISystem, level: []const u32) void {
+    if (level.len == 1) {
+        invokeParallelSystem(systems[level[0]]);
+        return;
+    }
+
+    var wait_group: std.Thread.WaitGroup = .{};
+    for (level) |index| {
+        const system = systems[index];
+        if (!system.access.main_thread) {
+            pool.spawnWg(&wait_group, invokeParallelSystem, .{system});
+        }
+    }
+
+    for (level) |index| {
+        const system = systems[index];
+        if (system.access.main_thread) {
+            invokeParallelSystem(system);
+        }
+    }
+
+    pool.waitAndWork(&wait_group);
+}
+
+fn invokeParallelSystem(system: ISystem) void {
+    current_access = &system.access;
+    defer current_access = null;
+    invokeSystem(system);
+}
+
+fn invokeSystem(system: ISystem) void {
+    system.invoke() catch |err| {
+        std.debug.panic("Failed to run system: '{s}'. Error: {}.", .{
+            system.getName(),
+            err,
+        });
+    };
+}
+
 const ISystem = struct {
     const VTable = struct {
         deinit: *const fn (ptr: *anyopaque, allocator: std.mem.Allocator) void,
@@ -135,6 +399,7 @@ const ISystem = struct {
 
     ptr: *anyopaque,
     vtable: VTable,
+    access: Access,
 
     fn deinit(self: ISystem, allocator: std.mem.Allocator) void {
         self.vtable.deinit(self.ptr, allocator);
@@ -161,6 +426,7 @@ fn generateSystem(
     comptime system: anytype,
     allocator: std.mem.Allocator,
     params: *ParamsType(system),
+    access: Access,
 ) !ISystem {
     const System = struct {
         const SystemSelf = @This();
@@ -209,5 +475,36 @@ fn generateSystem(
             .setFirstParam = System.setFirstParam,
             .getName = System.getName,
         },
+        .access = access,
     };
 }
+
+test "access" {
+    var write_a: Access = .{};
+    write_a.writes.set(0);
+
+    var read_a: Access = .{};
+    read_a.reads.set(0);
+
+    var read_a_write_b: Access = .{};
+    read_a_write_b.reads.set(0);
+    read_a_write_b.writes.set(1);
+
+    try std.testing.expect(write_a.conflicts(read_a));
+    try std.testing.expect(read_a.conflicts(write_a));
+    try std.testing.expect(!read_a.conflicts(read_a_write_b));
+    try std.testing.expect(write_a.conflicts(read_a_write_b));
+    try std.testing.expect(read_a.conflicts(.{ .exclusive = true }));
+
+    var write_resource: Access = .{};
+    write_resource.writes.set(2);
+    write_resource.resource_writes.set(0);
+
+    var read_resource: Access = .{};
+    read_resource.reads.set(3);
+    read_resource.resource_reads.set(0);
+
+    // Systems with disjoint components still conflict through a shared resource.
+    try std.testing.expect(write_resource.conflicts(read_resource));
+    try std.testing.expect(!read_resource.conflicts(read_resource));
+}
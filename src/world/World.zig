@@ -1,3 +1,4 @@
+const Commands = @import("Commands.zig");
 const Components = @import("Components.zig");
 const Entities = @import("Entities.zig");
 const Events = @import("Events.zig");
@@ -26,6 +27,7 @@ entities: Entities,
 components: Components,
 systems: Systems,
 resources: Resources,
+commands: Commands,
 queries: *Queries,
 events: *Events,
 _allocator: std.mem.Allocator,
@@ -47,6 +49,7 @@ pub fn init(allocator: std.mem.Allocator) !*Self {
         .components = .init(),
         .systems = .init(),
         .resources = .init(),
+        .commands = .init(result),
         .queries = queries,
         .events = events,
         ._allocator = allocator,
@@ -59,12 +62,21 @@ pub fn init(allocator: std.mem.Allocator) !*Self {
         world.components.core.Child,
     });
 
-    _ = try result.registerSystem(internal_systems.resolveTransforms, .postupdate);
+    try result.registerResource(world.Hierarchy, .{});
+    // Transform and Child are only read, but their changes are cleared once resolved.
+    _ = try result.registerSystemWith(internal_systems.resolveTransforms, .postupdate, .{
+        .writes = &.{
+            world.Hierarchy,
+            world.components.core.Transform,
+            world.components.core.Child,
+        },
+    });
 
     return result;
 }
 
 pub fn deinit(self: *Self) void {
+    self.commands.deinit();
     self.entities.deinit(self._allocator);
     self.components.deinit(self._allocator);
     self.systems.deinit(self._allocator);
@@ -76,36 +88,84 @@ pub fn deinit(self: *Self) void {
     self._allocator.destroy(self.events);
 }
 
-pub fn createEntity(self: *Self) Entity {
-    return self.entities.create();
+pub fn createEntity(self: *Self) !Entity {
+    if (Systems.verify_access) {
+        Systems.verifyStructuralChange("createEntity");
+    }
+
+    return try self.entities.create(self._allocator);
+}
+
+/// Fills the given slice with newly created entities.
+pub fn createEntities(self: *Self, entities: []Entity) !void {
+    if (Systems.verify_access) {
+        Systems.verifyStructuralChange("createEntities");
+    }
+
+    try self.entities.createMany(self._allocator, entities);
 }
 
 pub fn createEntityWith(self: *Self, components: anytype) !Entity {
-    const entity = self.createEntity();
+    const entity = try self.createEntity();
     try self.insertComponents(entity, components);
     return entity;
 }
 
 pub fn duplicateEntity(self: *Self, entity: Entity) !Entity {
-    const new_entity = self.createEntity();
+    const new_entity = try self.createEntity();
+    // The signature tracks the components copied so far, so destroying the entity removes them.
+    errdefer self.destroyEntity(new_entity) catch |err| {
+        std.log.warn("Failed to destroy partially duplicated entity. Error: {}", .{err});
+    };
 
+    // Components are copied before the queries are updated so a failed copy never leaves the
+    // entity in a query without its components.
     const signature = self.entities.getSignature(entity);
-    self.entities.setSignature(new_entity, signature);
-    try self.queries.signatureChanged(self._allocator, signature, new_entity);
-
     var it = signature.iterator(.{});
     while (it.next()) |component| {
-        const data = self.components.getById(@intCast(component), entity) orelse continue;
-        try self.components.insertById(self._allocator, @intCast(component), new_entity, data);
+        if (self.components.getById(@intCast(component), entity)) |data| {
+            try self.components.insertById(self._allocator, @intCast(component), new_entity, data);
+        }
+        self.entities.setSignatureBit(new_entity, component);
     }
 
+    try self.queries.signatureChanged(self._allocator, new_entity, .initEmpty(), signature);
+
     return new_entity;
 }
 
 pub fn destroyEntity(self: *Self, entity: Entity) !void {
+    if (Systems.verify_access) {
+        Systems.verifyStructuralChange("destroyEntity");
+    }
+
+    const signature = self.entities.getSignature(entity);
     try self.entities.destroy(self._allocator, entity);
-    try self.components.entityDestroyed(self._allocator, entity);
-    self.queries.entityDestroyed(entity);
+    try self.components.entityDestroyed(self._allocator, entity, signature);
+    self.queries.entityDestroyed(entity, signature);
+}
+
+/// Destroys all given entities. Stale handles are ignored.
+pub fn destroyEntities(self: *Self, entities: []const Entity) !void {
+    if (Systems.verify_access) {
+        Systems.verifyStructuralChange("destroyEntities");
+    }
+
+    for (entities) |entity| {
+        if (!self.entities.isAlive(entity)) {
+            continue;
+        }
+
+        const signature = self.entities.getSignature(entity);
+        try self.components.entityDestroyed(self._allocator, entity, signature);
+        self.queries.entityDestroyed(entity, signature);
+    }
+
+    _ = try self.entities.destroyMany(self._allocator, entities);
+}
+
+pub fn isAlive(self: Self, entity: Entity) bool {
+    return self.entities.isAlive(entity);
 }
 
 pub fn registerComponent(self: *Self, comptime T: type) !void {
@@ -119,19 +179,32 @@ pub fn registerComponents(self: *Self, comptime components: []const type) !void
 }
 
 pub fn insertComponent(self: *Self, comptime T: type, entity: Entity, component: T) !void {
+    if (Systems.verify_access) {
+        Systems.verifyStructuralChange("insertComponent");
+    }
+
+    if (!self.entities.isAlive(entity)) {
+        return Components.Error.InvalidEntity;
+    }
+
     // Add the actual component data
     try self.components.insert(T, self._allocator, entity, component);
 
     // Update which components the given entity has
     const component_id = self.components.getComponentId(T) orelse return;
+    const old_signature = self.entities.getSignature(entity);
     self.entities.setSignatureBit(entity, @intCast(component_id));
 
     // Notify all systems to move the entity to the proper sets
     const signature = self.entities.getSignature(entity);
-    try self.queries.signatureChanged(self._allocator, signature, entity);
+    try self.queries.signatureChanged(self._allocator, entity, old_signature, signature);
 }
 
 pub fn insertComponents(self: *Self, entity: Entity, components: anytype) !void {
+    if (Systems.verify_access) {
+        Systems.verifyStructuralChange("insertComponents");
+    }
+
     const ComponentsType = @TypeOf(components);
     const components_info = @typeInfo(ComponentsType);
     if (components_info != .@"struct") {
@@ -141,6 +214,11 @@ pub fn insertComponents(self: *Self, entity: Entity, components: anytype) !void
         ));
     }
 
+    if (!self.entities.isAlive(entity)) {
+        return Components.Error.InvalidEntity;
+    }
+
+    const old_signature = self.entities.getSignature(entity);
     inline for (std.meta.fields(ComponentsType), 0..) |field, i| {
         try self.components.insert(
             field.type,
@@ -167,20 +245,29 @@ pub fn insertComponents(self: *Self, entity: Entity, components: anytype) !void
     }
 
     const signature = self.entities.getSignature(entity);
-    try self.queries.signatureChanged(self._allocator, signature, entity);
+    try self.queries.signatureChanged(self._allocator, entity, old_signature, signature);
 }
 
 pub fn removeComponent(self: *Self, comptime T: type, entity: Entity) !void {
+    if (Systems.verify_access) {
+        Systems.verifyStructuralChange("removeComponent");
+    }
+
+    if (!self.entities.isAlive(entity)) {
+        return Components.Error.InvalidEntity;
+    }
+
     // Clear the component data
     try self.components.remove(T, self._allocator, entity);
 
     // Unset the appropriate component bit for the entity
     const component_id = self.components.getComponentId(T) orelse return;
+    const old_signature = self.entities.getSignature(entity);
     self.entities.unsetSignatureBit(entity, @intCast(component_id));
 
     // Notify all systems to move the entity to the proper sets
     const signature = self.entities.getSignature(entity);
-    try self.queries.signatureChanged(self._allocator, signature, entity);
+    try self.queries.signatureChanged(self._allocator, entity, old_signature, signature);
 }
 
 pub fn getOrInsertComponent(self: *Self, comptime T: type, entity: Entity) !?*T {
@@ -194,9 +281,27 @@ pub fn getOrInsertComponent(self: *Self, comptime T: type, entity: Entity) !?*T
 }
 
 pub fn getComponent(self: Self, comptime T: type, entity: Entity) ?*T {
+    if (Systems.verify_access) {
+        Systems.verifyComponent(self.components.getComponentId(T), @typeName(T));
+    }
+
     return self.components.get(T, entity);
 }
 
+/// Same as getComponent, but the component isn't marked as changed.
+pub fn readComponent(self: Self, comptime T: type, entity: Entity) ?*const T {
+    if (Systems.verify_access) {
+        Systems.verifyComponent(self.components.getComponentId(T), @typeName(T));
+    }
+
+    if (!entity.isValid()) {
+        return null;
+    }
+
+    const array = self.components.getArray(T) orelse return null;
+    return array.get(entity);
+}
+
 pub fn hasComponent(self: Self, comptime T: type, entity: Entity) bool {
     const id = self.components.getComponentId(T) orelse return false;
     const signature = self.entities.getSignature(entity);
@@ -213,14 +318,51 @@ pub fn registerSystem(
     self: *Self,
     system: anytype,
     schedule: Systems.Schedule,
+) !Systems.SystemId {
+    return self.registerSystemWith(system, schedule, .{});
+}
+
+/// Same as registerSystem, but allows pinning the system to the main thread, marking it as
+/// exclusive, or declaring the components and resources it accesses outside of its queries when
+/// running schedules in parallel. Types in 'reads' and 'writes' that aren't registered components
+/// are treated as resources.
+pub fn registerSystemWith(
+    self: *Self,
+    system: anytype,
+    schedule: Systems.Schedule,
+    comptime options: Systems.Options,
 ) !Systems.SystemId {
     verifySystem(system);
 
     // Get the tuple type and instance it. This instance will be passed in as parameters to the
     // given system.
-    const params = try self.parseSystemParams(system);
+    var access: Systems.Access = .{};
+    const params = try self.parseSystemParams(system, &access);
+    errdefer self._allocator.destroy(params);
+
+    inline for (options.reads) |T| {
+        try self.declareAccess(T, &access.reads, &access.resource_reads);
+    }
+    inline for (options.writes) |T| {
+        try self.declareAccess(T, &access.writes, &access.resource_writes);
+    }
+
+    access.main_thread = access.main_thread or options.main_thread;
+    access.exclusive = access.exclusive or options.exclusive;
 
-    const system_id = try self.systems.register(self._allocator, system, params, schedule);
+    // The access of systems that don't query or declare anything can't be determined.
+    if (access.isEmpty()) {
+        access.exclusive = true;
+        access.main_thread = true;
+    }
+
+    const system_id = try self.systems.register(
+        self._allocator,
+        system,
+        params,
+        schedule,
+        access,
+    );
     return system_id;
 }
 
@@ -228,8 +370,27 @@ pub fn unregisterSystem(self: *Self, system: Systems.SystemId) void {
     self.systems.unregister(self._allocator, system);
 }
 
+/// Runs all systems in the schedule. Any commands recorded by the systems are applied once all
+/// systems have finished.
 pub fn runSystems(self: *Self, schedule: Systems.Schedule) void {
-    self.systems.run(schedule);
+    self.systems.run(self, schedule);
+    self.applyCommands();
+}
+
+/// Systems within the parallel schedules that don't conflict will be run on the given pool. A
+/// null pool runs every system serially in registration order.
+pub fn setThreadPool(self: *Self, pool: ?*std.Thread.Pool) void {
+    self.systems.pool = pool;
+}
+
+pub fn applyCommands(self: *Self) void {
+    if (self.commands.isEmpty()) {
+        return;
+    }
+
+    self.commands.apply() catch |err| {
+        std.debug.panic("Failed to apply commands. Error: {}.", .{err});
+    };
 }
 
 pub fn registerResource(self: *Self, comptime T: type, resource: T) !void {
@@ -237,6 +398,10 @@ pub fn registerResource(self: *Self, comptime T: type, resource: T) !void {
 }
 
 pub fn getResource(self: Self, comptime T: type) ?*T {
+    if (Systems.verify_access) {
+        Systems.verifyResource(self.resources.getId(T), @typeName(T));
+    }
+
     return self.resources.get(T);
 }
 
@@ -253,7 +418,8 @@ pub fn registerEvents(self: *Self, comptime EventTypes: []const type) !void {
 /// Same as registerSystem, but the system is not added to a schedule.
 pub fn registerEventListener(self: *Self, system: anytype) !void {
     verifySystem(system);
-    const params = try self.parseSystemParams(system);
+    var access: Systems.Access = .{};
+    const params = try self.parseSystemParams(system, &access);
     const event_type = blk: {
         const params_info = @typeInfo(@TypeOf(params.*));
         break :blk params_info.@"struct".fields[0].type;
@@ -262,8 +428,21 @@ pub fn registerEventListener(self: *Self, system: anytype) !void {
     try self.events.addListener(event_type, self._allocator, system_id);
 }
 
+/// Runs the listeners of the event. Events triggered by a system running in parallel are queued
+/// and dispatched once the system's level has finished, so any memory the event references must
+/// outlive the level.
 pub fn triggerEvent(self: Self, event: anytype) void {
     const event_type = @TypeOf(event);
+    if (Systems.isRunningInParallel()) {
+        self.events.queue(self._allocator, event) catch |err| {
+            std.debug.panic(
+                "Failed to queue event '{s}'. Error: {}.",
+                .{ @typeName(event_type), err },
+            );
+        };
+        return;
+    }
+
     const listeners = self.events.getListeners(event_type);
     for (listeners) |system| {
         _ = self.systems.setFirstSystemParam(system, event);
@@ -271,7 +450,15 @@ pub fn triggerEvent(self: Self, event: anytype) void {
     }
 }
 
-fn parseSystemParams(self: *Self, system: anytype) !*std.meta.ArgsTuple(@TypeOf(system)) {
+pub fn dispatchQueuedEvents(self: *Self) void {
+    self.events.dispatchQueued(self);
+}
+
+fn parseSystemParams(
+    self: *Self,
+    system: anytype,
+    access: *Systems.Access,
+) !*std.meta.ArgsTuple(@TypeOf(system)) {
     // Get the tuple type and instance it. This instance will be passed in as parameters to the
     // given system.
     const ParametersType = std.meta.ArgsTuple(@TypeOf(system));
@@ -298,7 +485,8 @@ fn parseSystemParams(self: *Self, system: anytype) !*std.meta.ArgsTuple(@TypeOf(
             var signature: Signature = .initEmpty();
 
             const param_default = std.mem.zeroInit(param_type, .{});
-            inline for (param_default.components) |component| {
+            inline for (param_default.components) |query_component| {
+                const component = Queries.ComponentType(query_component);
                 const component_info = @typeInfo(component);
                 if (component_info != .@"struct") {
                     @compileError(std.fmt.comptimePrint(
@@ -314,6 +502,12 @@ fn parseSystemParams(self: *Self, system: anytype) !*std.meta.ArgsTuple(@TypeOf(
                     );
                 };
                 signature.set(@intCast(id));
+
+                if (Queries.isReadOnly(query_component)) {
+                    access.reads.set(@intCast(id));
+                } else {
+                    access.writes.set(@intCast(id));
+                }
             }
 
             // Check for duplicate queries within the system.
@@ -369,6 +563,21 @@ fn parseSystemParams(self: *Self, system: anytype) !*std.meta.ArgsTuple(@TypeOf(
     return params;
 }
 
+/// Adds the component or resource to the given access sets.
+fn declareAccess(
+    self: *Self,
+    comptime T: type,
+    components: *Signature,
+    resources: *Resources.Signature,
+) !void {
+    if (self.components.getComponentId(T)) |id| {
+        components.set(@intCast(id));
+    } else {
+        const id = try self.resources.getOrAddId(self._allocator, T);
+        resources.set(@intCast(id));
+    }
+}
+
 fn verifySystem(system: anytype) void {
     const system_info = @typeInfo(@TypeOf(system));
     if (system_info != .@"fn") {
@@ -396,7 +605,7 @@ test "add entity" {
     const _world: *Self = try .init(allocator);
     defer destroyWorld(_world);
 
-    const entity = _world.createEntity();
+    const entity = try _world.createEntity();
     try std.testing.expectEqual(0, entity.id);
 }
 
@@ -406,9 +615,9 @@ test "destroy entity" {
     const _world: *Self = try .init(allocator);
     defer destroyWorld(_world);
 
-    const entity1 = _world.createEntity();
-    const entity2 = _world.createEntity();
-    const entity3 = _world.createEntity();
+    const entity1 = try _world.createEntity();
+    const entity2 = try _world.createEntity();
+    const entity3 = try _world.createEntity();
 
     try std.testing.expectEqual(0, entity1.id);
     try std.testing.expectEqual(1, entity2.id);
@@ -419,10 +628,65 @@ test "destroy entity" {
     try _world.destroyEntity(entity2);
     try std.testing.expectEqual(null, _world.getComponent(Transform, entity2));
 
-    const entity4 = _world.createEntity();
+    const entity4 = try _world.createEntity();
     try std.testing.expectEqual(1, entity4.id);
 }
 
+test "stale entity" {
+    const allocator = std.testing.allocator;
+
+    const _world: *Self = try .init(allocator);
+    defer destroyWorld(_world);
+
+    const entity = try _world.createEntityWith(.{Transform{}});
+    try _world.destroyEntity(entity);
+    try std.testing.expect(!_world.isAlive(entity));
+
+    const recycled = try _world.createEntityWith(.{Transform{}});
+    try std.testing.expectEqual(entity.id, recycled.id);
+    try std.testing.expect(_world.isAlive(recycled));
+
+    try std.testing.expectEqual(null, _world.getComponent(Transform, entity));
+    try std.testing.expect(!_world.hasComponent(Transform, entity));
+    try std.testing.expect(_world.getComponent(Transform, recycled) != null);
+    try std.testing.expectError(Entities.Error.StaleEntity, _world.destroyEntity(entity));
+    try std.testing.expectError(
+        Components.Error.InvalidEntity,
+        _world.insertComponent(Transform, entity, .{}),
+    );
+}
+
+test "create entities" {
+    const allocator = std.testing.allocator;
+
+    const _world: *Self = try .init(allocator);
+    defer destroyWorld(_world);
+
+    try _world.registerComponent(ComponentA);
+    _ = try _world.registerSystem(systemA, .update);
+
+    const entities = try allocator.alloc(Entity, Entities.chunk_size + 1);
+    defer allocator.free(entities);
+
+    try _world.createEntities(entities);
+    for (entities) |entity| {
+        try _world.insertComponent(ComponentA, entity, .{});
+    }
+
+    _world.runSystems(.update);
+
+    for (entities) |entity| {
+        const a = _world.getComponent(ComponentA, entity) orelse unreachable;
+        try std.testing.expectEqual(1, a.count);
+    }
+
+    try _world.destroyEntities(entities);
+    for (entities) |entity| {
+        try std.testing.expect(!_world.isAlive(entity));
+        try std.testing.expectEqual(null, _world.getComponent(ComponentA, entity));
+    }
+}
+
 test "duplicate entity" {
     const allocator = std.testing.allocator;
 
@@ -461,7 +725,7 @@ test "add component" {
     const _world: *Self = try .init(allocator);
     defer destroyWorld(_world);
 
-    const entity = _world.createEntity();
+    const entity = try _world.createEntity();
     try _world.insertComponent(Transform, entity, .{
         .translation = .init(
             1.0,
@@ -485,7 +749,7 @@ test "remove component" {
     const _world: *Self = try .init(allocator);
     defer destroyWorld(_world);
 
-    const entity = _world.createEntity();
+    const entity = try _world.createEntity();
     try _world.insertComponent(Transform, entity, .{
         .translation = .splat(1.0),
     });
@@ -507,7 +771,7 @@ test "update component" {
     const _world: *Self = try .init(allocator);
     defer destroyWorld(_world);
 
-    const entity = _world.createEntity();
+    const entity = try _world.createEntity();
     try _world.insertComponent(Transform, entity, .{
         .translation = .splat(1.0),
     });
@@ -589,7 +853,7 @@ test "register system" {
     try _world.registerComponent(ComponentA);
     _ = try _world.registerSystem(systemA, .startup);
 
-    const entity = _world.createEntity();
+    const entity = try _world.createEntity();
     try _world.insertComponent(ComponentA, entity, .{});
 
     _world.runSystems(.startup);
@@ -607,7 +871,7 @@ test "unregister system" {
     try _world.registerComponent(ComponentA);
     const system = try _world.registerSystem(systemA, .startup);
 
-    const entity = _world.createEntity();
+    const entity = try _world.createEntity();
     try _world.insertComponent(ComponentA, entity, .{});
 
     _world.runSystems(.startup);
@@ -634,11 +898,11 @@ test "multiple queries" {
 
     _ = try _world.registerSystem(systemABC, .update);
 
-    const entityAB = _world.createEntity();
+    const entityAB = try _world.createEntity();
     try _world.insertComponent(ComponentA, entityAB, .{});
     try _world.insertComponent(ComponentB, entityAB, .{});
 
-    const entityC = _world.createEntity();
+    const entityC = try _world.createEntity();
     try _world.insertComponent(ComponentC, entityC, .{});
 
     _world.runSystems(.update);
@@ -666,11 +930,11 @@ test "multiple queries remove component" {
 
     _ = try _world.registerSystem(systemABC, .update);
 
-    const entityAB = _world.createEntity();
+    const entityAB = try _world.createEntity();
     try _world.insertComponent(ComponentA, entityAB, .{});
     try _world.insertComponent(ComponentB, entityAB, .{});
 
-    const entityC = _world.createEntity();
+    const entityC = try _world.createEntity();
     try _world.insertComponent(ComponentC, entityC, .{});
 
     _world.runSystems(.update);
@@ -719,8 +983,8 @@ test "multiple systems" {
     _ = try _world.registerSystem(systemA, .update);
     _ = try _world.registerSystem(systemAB, .update);
 
-    const entityA = _world.createEntity();
-    const entityAB = _world.createEntity();
+    const entityA = try _world.createEntity();
+    const entityAB = try _world.createEntity();
 
     try _world.insertComponent(ComponentA, entityA, .{});
     try _world.insertComponent(ComponentA, entityAB, .{});
@@ -751,7 +1015,7 @@ test "entity change systems" {
     _ = try _world.registerSystem(systemA, .update);
     _ = try _world.registerSystem(systemAB, .update);
 
-    const entity = _world.createEntity();
+    const entity = try _world.createEntity();
     try _world.insertComponent(ComponentA, entity, .{});
     _world.runSystems(.update);
 
@@ -829,7 +1093,7 @@ test "insert components" {
 
     try _world.registerComponents(&.{ ComponentA, ComponentB });
 
-    const entity = _world.createEntity();
+    const entity = try _world.createEntity();
     try _world.insertComponents(
         entity,
         .{
@@ -878,6 +1142,58 @@ test "event" {
     try std.testing.expectEqual(event.count, a.count);
 }
 
+const EventCounter = struct {
+    dispatched: u32 = 0,
+    /// The number of dispatched events seen right after triggering one.
+    seen: u32 = 0,
+};
+
+fn systemTriggerEvent(b: Query(&.{world.Read(ComponentB)}), param: SystemParam) !void {
+    _ = b;
+    param.world.triggerEvent(EventA{ .count = 1 });
+
+    const counter = param.world.getResource(EventCounter) orelse unreachable;
+    counter.seen = counter.dispatched;
+}
+
+fn systemCountEvent(event: EventA, param: SystemParam) !void {
+    const counter = param.world.getResource(EventCounter) orelse unreachable;
+    counter.dispatched += event.count;
+}
+
+test "event from parallel system" {
+    const allocator = std.testing.allocator;
+
+    const _world: *Self = try .init(allocator);
+    defer destroyWorld(_world);
+
+    var pool: std.Thread.Pool = undefined;
+    try pool.init(.{ .allocator = allocator, .n_jobs = 2 });
+    defer pool.deinit();
+    _world.setThreadPool(&pool);
+
+    try _world.registerComponents(&.{ ComponentA, ComponentB });
+    try _world.registerResource(EventCounter, .{});
+    try _world.registerEvent(EventA);
+    try _world.registerEventListener(systemCountEvent);
+    _ = try _world.registerSystem(systemWriteA, .update);
+    _ = try _world.registerSystemWith(systemTriggerEvent, .update, .{
+        .writes = &.{EventCounter},
+    });
+
+    _ = try _world.createEntityWith(.{ ComponentA{}, ComponentB{} });
+
+    // The listener runs after the level, not while the triggering system is running.
+    _world.runSystems(.update);
+    const counter = _world.getResource(EventCounter).?;
+    try std.testing.expectEqual(1, counter.dispatched);
+    try std.testing.expectEqual(0, counter.seen);
+
+    _world.runSystems(.update);
+    try std.testing.expectEqual(2, counter.dispatched);
+    try std.testing.expectEqual(1, counter.seen);
+}
+
 const MarkerComponent = struct {};
 
 fn systemMarker(markers: Query(&.{MarkerComponent}), param: SystemParam) !void {
@@ -902,6 +1218,210 @@ test "marker component" {
     _world.runSystems(.startup);
 }
 
+fn systemIterAB(ab: Query(&.{ ComponentA, ComponentB }), param: SystemParam) !void {
+    var it = ab.iter(param.world);
+    while (it.next()) |item| {
+        item.get(ComponentA).count += 1;
+        item.get(ComponentB).count += 2;
+    }
+}
+
+test "query iterator" {
+    const allocator = std.testing.allocator;
+
+    const _world: *Self = try .init(allocator);
+    defer destroyWorld(_world);
+
+    try _world.registerComponents(&.{ ComponentA, ComponentB });
+    _ = try _world.registerSystem(systemIterAB, .update);
+
+    const entity_a = try _world.createEntityWith(.{ComponentA{}});
+    const entity_ab = try _world.createEntityWith(.{ ComponentA{}, ComponentB{} });
+    const entity_b = try _world.createEntityWith(.{ComponentB{ .count = 10 }});
+
+    _world.runSystems(.update);
+
+    try std.testing.expectEqual(0, _world.getComponent(ComponentA, entity_a).?.count);
+    try std.testing.expectEqual(1, _world.getComponent(ComponentA, entity_ab).?.count);
+    try std.testing.expectEqual(2, _world.getComponent(ComponentB, entity_ab).?.count);
+    try std.testing.expectEqual(10, _world.getComponent(ComponentB, entity_b).?.count);
+
+    // Removing a component swaps the last element into the removed slot. Make sure the moved
+    // component is still found through its entity.
+    try _world.removeComponent(ComponentA, entity_a);
+    _world.runSystems(.update);
+
+    try std.testing.expectEqual(null, _world.getComponent(ComponentA, entity_a));
+    try std.testing.expectEqual(2, _world.getComponent(ComponentA, entity_ab).?.count);
+    try std.testing.expectEqual(4, _world.getComponent(ComponentB, entity_ab).?.count);
+}
+
+fn systemIterMarker(
+    query: Query(&.{ ComponentA, MarkerComponent }),
+    param: SystemParam,
+) !void {
+    var it = query.iter(param.world);
+    while (it.next()) |item| {
+        item.get(ComponentA).count += 1;
+    }
+}
+
+test "query iterator marker" {
+    const allocator = std.testing.allocator;
+
+    const _world: *Self = try .init(allocator);
+    defer destroyWorld(_world);
+
+    try _world.registerComponents(&.{ ComponentA, MarkerComponent });
+    _ = try _world.registerSystem(systemIterMarker, .update);
+
+    const entity = try _world.createEntityWith(.{ComponentA{}});
+    const marked = try _world.createEntityWith(.{ ComponentA{}, MarkerComponent{} });
+
+    _world.runSystems(.update);
+
+    try std.testing.expectEqual(0, _world.getComponent(ComponentA, entity).?.count);
+    try std.testing.expectEqual(1, _world.getComponent(ComponentA, marked).?.count);
+}
+
+fn systemCommands(ab: Query(&.{ ComponentA, ComponentB }), param: SystemParam) !void {
+    var entities = ab.getEntities();
+    while (entities.next()) |entity| {
+        const a = param.getComponent(ComponentA, entity.*) orelse continue;
+        if (a.count == 0) {
+            try param.commands().remove(ComponentB, entity.*);
+            try param.commands().insert(entity.*, ComponentC{ .count = 3 });
+        } else {
+            try param.commands().destroy(entity.*);
+        }
+    }
+
+    _ = try param.commands().spawn(.{ ComponentA{ .count = 7 }, ComponentB{} });
+}
+
+test "commands" {
+    const allocator = std.testing.allocator;
+
+    const _world: *Self = try .init(allocator);
+    defer destroyWorld(_world);
+
+    try _world.registerComponents(&.{ ComponentA, ComponentB, ComponentC });
+    const system = try _world.registerSystem(systemCommands, .update);
+    _ = try _world.registerSystem(systemABC, .postupdate);
+
+    const kept = try _world.createEntityWith(.{ ComponentA{}, ComponentB{} });
+    const destroyed = try _world.createEntityWith(.{ ComponentA{ .count = 1 }, ComponentB{} });
+
+    _world.runSystems(.update);
+    _world.unregisterSystem(system);
+
+    try std.testing.expect(!_world.isAlive(destroyed));
+    try std.testing.expect(!_world.hasComponent(ComponentB, kept));
+    try std.testing.expect(_world.hasComponent(ComponentC, kept));
+
+    // Only the spawned entity is left in the (A, B) query, and 'kept' is now in the (C) query.
+    _world.runSystems(.postupdate);
+
+    try std.testing.expectEqual(0, _world.getComponent(ComponentA, kept).?.count);
+    try std.testing.expectEqual(6, _world.getComponent(ComponentC, kept).?.count);
+    try std.testing.expectEqual(2, _world.entities.count);
+}
+
+fn systemWriteA(a: Query(&.{ComponentA}), param: SystemParam) !void {
+    var it = a.iter(param.world);
+    while (it.next()) |item| {
+        item.get(ComponentA).count += 1;
+    }
+}
+
+fn systemWriteB(b: Query(&.{ComponentB}), param: SystemParam) !void {
+    var it = b.iter(param.world);
+    while (it.next()) |item| {
+        item.get(ComponentB).count += 1;
+    }
+}
+
+fn systemReadAWriteC(
+    ac: Query(&.{ world.Read(ComponentA), ComponentC }),
+    param: SystemParam,
+) !void {
+    var it = ac.iter(param.world);
+    while (it.next()) |item| {
+        item.get(ComponentC).count = item.get(ComponentA).count;
+    }
+}
+
+test "parallel systems" {
+    const allocator = std.testing.allocator;
+
+    const _world: *Self = try .init(allocator);
+    defer destroyWorld(_world);
+
+    var pool: std.Thread.Pool = undefined;
+    try pool.init(.{ .allocator = allocator, .n_jobs = 2 });
+    defer pool.deinit();
+    _world.setThreadPool(&pool);
+
+    try _world.registerComponents(&.{ ComponentA, ComponentB, ComponentC });
+    _ = try _world.registerSystem(systemWriteA, .update);
+    _ = try _world.registerSystem(systemWriteB, .update);
+    _ = try _world.registerSystem(systemReadAWriteC, .update);
+
+    const entity = try _world.createEntityWith(.{ ComponentA{}, ComponentB{}, ComponentC{} });
+
+    for (0..3) |_| {
+        _world.runSystems(.update);
+    }
+
+    // systemWriteA and systemWriteB don't conflict. systemReadAWriteC reads ComponentA so it must
+    // run after systemWriteA.
+    const graph = _world.systems._graphs[@intFromEnum(Systems.Schedule.update)];
+    try std.testing.expectEqualSlices(u32, &.{ 2, 3 }, graph.level_ends.items);
+    try std.testing.expectEqualSlices(u32, &.{ 0, 1, 2 }, graph.order.items);
+
+    try std.testing.expectEqual(3, _world.getComponent(ComponentA, entity).?.count);
+    try std.testing.expectEqual(3, _world.getComponent(ComponentB, entity).?.count);
+    try std.testing.expectEqual(3, _world.getComponent(ComponentC, entity).?.count);
+}
+
+fn systemCountA(a: Query(&.{world.Read(ComponentA)}), param: SystemParam) !void {
+    const resource = param.world.getResource(TestResource) orelse unreachable;
+    resource.value += @intCast(a.numEntities());
+}
+
+fn systemCountB(b: Query(&.{world.Read(ComponentB)}), param: SystemParam) !void {
+    const resource = param.world.getResource(TestResource) orelse unreachable;
+    resource.value += @intCast(b.numEntities());
+}
+
+test "parallel systems with resources" {
+    const allocator = std.testing.allocator;
+
+    const _world: *Self = try .init(allocator);
+    defer destroyWorld(_world);
+
+    var pool: std.Thread.Pool = undefined;
+    try pool.init(.{ .allocator = allocator, .n_jobs = 2 });
+    defer pool.deinit();
+    _world.setThreadPool(&pool);
+
+    try _world.registerComponents(&.{ ComponentA, ComponentB });
+    try _world.registerResource(TestResource, .{});
+    _ = try _world.registerSystemWith(systemCountA, .update, .{ .writes = &.{TestResource} });
+    _ = try _world.registerSystemWith(systemCountB, .update, .{ .writes = &.{TestResource} });
+
+    _ = try _world.createEntityWith(.{ ComponentA{}, ComponentB{} });
+
+    for (0..3) |_| {
+        _world.runSystems(.update);
+    }
+
+    // The queries don't conflict, but both systems write the same resource.
+    const graph = _world.systems._graphs[@intFromEnum(Systems.Schedule.update)];
+    try std.testing.expectEqualSlices(u32, &.{ 1, 2 }, graph.level_ends.items);
+    try std.testing.expectEqual(6, _world.getResource(TestResource).?.value);
+}
+
 test "hierarchy" {
     const allocator = std.testing.allocator;
 
@@ -935,3 +1455,95 @@ test "hierarchy" {
     try std.testing.expectEqual(2.0, position.y());
     try std.testing.expectEqual(0.0, position.z());
 }
+
+test "hierarchy multiple levels" {
+    const allocator = std.testing.allocator;
+
+    const _world: *Self = try .init(allocator);
+    defer destroyWorld(_world);
+
+    const root = try _world.createEntityWith(.{
+        Transform{
+            .translation = .init3(1.0, 0.0, 0.0),
+        },
+    });
+
+    const parent = try _world.createEntityWith(.{
+        Transform{
+            .translation = .init3(0.0, 2.0, 0.0),
+        },
+        world.components.core.Child{
+            .parent = root,
+        },
+    });
+
+    // Created before its parent has a transform to verify the order is independent of ids.
+    const child = try _world.createEntity();
+    try _world.insertComponents(child, .{
+        Transform{
+            .translation = .init3(0.0, 0.0, 3.0),
+        },
+        world.components.core.Child{
+            .parent = parent,
+        },
+    });
+
+    _world.runSystems(.postupdate);
+
+    const hierarchy = _world.getResource(world.Hierarchy) orelse unreachable;
+    try std.testing.expectEqual(3, hierarchy.resolved.items.len);
+
+    {
+        const resolved = _world.getComponent(
+            world.components.core.ResolvedTransform,
+            child,
+        ) orelse unreachable;
+
+        const position = resolved.transform.getTranslation();
+        try std.testing.expectEqual(1.0, position.x());
+        try std.testing.expectEqual(2.0, position.y());
+        try std.testing.expectEqual(3.0, position.z());
+    }
+
+    // Nothing changed, so nothing is resolved.
+    _world.runSystems(.postupdate);
+    try std.testing.expectEqual(0, hierarchy.resolved.items.len);
+
+    // Changing the root resolves the whole subtree.
+    _world.getComponent(Transform, root).?.translation = .init3(4.0, 0.0, 0.0);
+    _world.runSystems(.postupdate);
+    try std.testing.expectEqual(3, hierarchy.resolved.items.len);
+
+    {
+        const resolved = _world.getComponent(
+            world.components.core.ResolvedTransform,
+            child,
+        ) orelse unreachable;
+
+        const position = resolved.transform.getTranslation();
+        try std.testing.expectEqual(4.0, position.x());
+        try std.testing.expectEqual(2.0, position.y());
+        try std.testing.expectEqual(3.0, position.z());
+    }
+
+    // Changing a leaf only resolves the leaf.
+    _world.getComponent(Transform, child).?.translation = .init3(0.0, 0.0, 5.0);
+    _world.runSystems(.postupdate);
+    try std.testing.expectEqual(1, hierarchy.resolved.items.len);
+
+    // Reparenting the child onto the root removes the middle level.
+    _world.getComponent(world.components.core.Child, child).?.parent = root;
+    _world.runSystems(.postupdate);
+
+    {
+        const resolved = _world.getComponent(
+            world.components.core.ResolvedTransform,
+            child,
+        ) orelse unreachable;
+
+        const position = resolved.transform.getTranslation();
+        try std.testing.expectEqual(4.0, position.x());
+        try std.testing.expectEqual(0.0, position.y());
+        try std.testing.expectEqual(5.0, position.z());
+    }
+}
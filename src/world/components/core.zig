@@ -7,7 +7,10 @@ const Mat = core.math.Mat;
 const Rotation = core.math.Rotation;
 const Vec = core.math.Vec;
 
+/// Changes are consumed by the transform hierarchy.
 pub const Transform = struct {
+    pub const track_changes = true;
+
     translation: Vec = .zero,
     rotation: Rotation = .zero,
     scale: Vec = .splat(1.0),
@@ -19,10 +22,25 @@ pub const Transform = struct {
     }
 };
 
+/// The world matrix of an entity with its parents applied. This is maintained by the transform
+/// hierarchy for every entity with a Transform and is only recomputed when the entity or one of
+/// its parents has changed.
 pub const ResolvedTransform = struct {
     transform: Mat = .identity,
+    /// The inverse transpose of 'transform' used to transform normals.
+    normal: Mat = .identity,
+
+    pub fn init(transform: Mat) ResolvedTransform {
+        return .{
+            .transform = transform,
+            .normal = transform.inverse().transpose(),
+        };
+    }
 };
 
+/// Changes are consumed by the transform hierarchy to detect reparenting.
 pub const Child = struct {
+    pub const track_changes = true;
+
     parent: Entity = .invalid,
 };
@@ -1,8 +1,10 @@
 const core = @import("core");
 const std = @import("std");
 
+pub const Commands = @import("Commands.zig");
 pub const components = @import("components/root.zig");
 const Entities = @import("Entities.zig");
+pub const Hierarchy = @import("Hierarchy.zig");
 const Queries = @import("Queries.zig");
 pub const Systems = @import("Systems.zig");
 pub const World = @import("World.zig");
@@ -11,6 +13,7 @@ pub const Entity = Entities.Entity;
 pub const Handle = core.Handle;
 pub const HashSetUnmanaged = core.containers.HashSetUnmanaged;
 pub const Query = Queries.Query;
+pub const Read = Queries.Read;
 pub const SystemParam = Systems.SystemParam;
 
 test "refall" {
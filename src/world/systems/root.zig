@@ -1,56 +1,45 @@
-const core = @import("core");
 const std = @import("std");
 const world = @import("../root.zig");
 
 const components = world.components;
-const Entity = world.Entity;
-const Mat = core.math.Mat;
+const Hierarchy = world.Hierarchy;
 const Query = world.Query;
+const Read = world.Read;
 const SystemParam = world.SystemParam;
 
+/// Resolves the world matrix of every entity with a Transform, including all of its parents.
+/// Only entities whose transform or parents changed since the last frame are visited.
 pub fn resolveTransforms(
-    children: Query(&.{components.core.Transform, components.core.Child}),
+    transforms: Query(&.{Read(components.core.Transform)}),
+    children: Query(&.{ Read(components.core.Transform), Read(components.core.Child) }),
+    resolved: Query(&.{components.core.ResolvedTransform}),
     param: SystemParam,
 ) !void {
-    var entities = children.getEntities();
-    while (entities.next()) |entity| {
-        const child = param.getComponent(components.core.Child, entity.*) orelse continue;
-
-        const resolved_transform = try param.world.getOrInsertComponent(
-            components.core.ResolvedTransform,
-            entity.*,
-        ) orelse {
-            std.log.warn("Failed to insert ResolvedTransform to entity {}.", .{entity.id});
-            continue;
+    const hierarchy = param.world.getResource(Hierarchy) orelse unreachable;
+
+    const entities = if (transforms.entities) |entities| entities.slice() else &.{};
+    try hierarchy.update(
+        param.allocator,
+        param.world,
+        entities,
+        transforms.getVersion(),
+        children.getVersion(),
+    );
+
+    const nodes = hierarchy.nodes.slice();
+    for (hierarchy.resolved.items) |i| {
+        const entity = nodes.items(.entity)[i];
+        const result: components.core.ResolvedTransform = .{
+            .transform = nodes.items(.world)[i],
+            .normal = nodes.items(.normal)[i],
         };
 
-        resolved_transform.transform = resolveTransform(entity.*, child.*, param);
-    }
-}
-
-fn resolveTransform(
-    entity: Entity,
-    child: components.core.Child,
-    param: SystemParam,
-) Mat {
-    const transform = param.getComponent(
-        components.core.Transform,
-        entity,
-    ) orelse return .identity;
-
-    const parent = param.getComponent(
-        components.core.Transform,
-        child.parent,
-    ) orelse return transform.toMatrix();
-
-    return transform.toMatrix().mul(parent.toMatrix());
-}
-
-fn getResolvedTransform(entity: Entity, param: SystemParam) !*components.core.ResolvedTransform {
-    if (param.world.getComponent(components.core.ResolvedTransform, entity)) |result| {
-        return result;
-    } else {
-        try param.world.insertComponent(components.core.ResolvedTransform, entity, .{});
-        return param.getComponent(components.core.ResolvedTransform, entity).?;
+        // Inserting the component is deferred so the queries aren't modified while iterating.
+        if (resolved.hasEntity(entity)) {
+            const component = param.getComponent(components.core.ResolvedTransform, entity).?;
+            component.* = result;
+        } else {
+            try param.commands().insert(entity, result);
+        }
     }
 }